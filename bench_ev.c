@@ -0,0 +1,507 @@
+/**
+ * @author joelai
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "priv.h"
+
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+static struct {
+	const char *ev_backend;
+	unsigned long iter;
+	int socks; /**< Socket pair for io bench. */
+	int rate; /**< Socket pair made ready per loop. */
+	unsigned long loops; /**< Loop for io bench. */
+	int tmrs; /**< Timer for timer bench. */
+	unsigned long dur; /**< Milli-seconds for timer bench. */
+	unsigned long spin; /**< Micro-seconds to busy poll for io and timer. */
+	unsigned long *lat; /**< Dispatch latency in nano-seconds. */
+	unsigned long lat_cnt, lat_cap;
+	unsigned long alloc; /**< Count of memory allocation. */
+} impl = {.iter = 1000000ul, .socks = 1000, .rate = 100, .loops = 10000ul,
+		.tmrs = 1000, .dur = 1000ul};
+
+#ifdef __GLIBC__
+/* count allocation by the event loop */
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void*, size_t);
+extern void *__libc_memalign(size_t, size_t);
+
+void* malloc(size_t sz) {
+	impl.alloc++;
+	return __libc_malloc(sz);
+}
+
+void* calloc(size_t n, size_t sz) {
+	impl.alloc++;
+	return __libc_calloc(n, sz);
+}
+
+void* realloc(void *p, size_t sz) {
+	impl.alloc++;
+	return __libc_realloc(p, sz);
+}
+
+int posix_memalign(void **p, size_t align, size_t sz) {
+	impl.alloc++;
+	return (*p = __libc_memalign(align, sz)) ? 0 : ENOMEM;
+}
+#endif
+
+__attribute__((format(printf, 4, 5)))
+int log_printf(const char *lvl, const char *func_name, int lno,
+		const char *fmt, ...) {
+	int r;
+	va_list va;
+
+	if ((int)(unsigned long)lvl != log_level_err) return 0;
+	fprintf(stderr, "[%s][#%d]", func_name, lno);
+	va_start(va, fmt);
+	r = vfprintf(stderr, fmt, va);
+	va_end(va);
+	return r;
+}
+
+static void bench_on_noti(int fd, unsigned ev_noti, void *cbarg) {
+}
+
+static unsigned long bench_ns(const struct timespec *ts0) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ALOE_TIMESEC_SUB(ts.tv_sec, ts.tv_nsec, ts0->tv_sec, ts0->tv_nsec,
+			ts.tv_sec, ts.tv_nsec, 1000000000ul);
+	return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+static unsigned long bench_rand(unsigned long *seed) {
+	*seed = *seed * 6364136223846793005ul + 1442695040888963407ul;
+	return *seed >> 33;
+}
+
+/** Record latency sample, drop when full. */
+static void lat_add(unsigned long ns) {
+	if (impl.lat_cnt < impl.lat_cap) impl.lat[impl.lat_cnt++] = ns;
+}
+
+static int lat_cmp(const void *a, const void *b) {
+	unsigned long va = *(const unsigned long*)a, vb = *(const unsigned long*)b;
+
+	return va < vb ? -1 : va > vb ? 1 : 0;
+}
+
+static int lat_reset(unsigned long cap) {
+	unsigned long *lat;
+
+	if (cap > impl.lat_cap) {
+		if (!(lat = realloc(impl.lat, cap * sizeof(*lat)))) {
+			log_e("malloc latency sample\n");
+			return ENOMEM;
+		}
+		impl.lat = lat;
+		impl.lat_cap = cap;
+	}
+	impl.lat_cnt = 0;
+	return 0;
+}
+
+/** Print latency percentile to complete the result line. */
+static void lat_print(void) {
+	static const struct {
+		const char *name;
+		unsigned long pm; /**< Per mille. */
+	} pct[] = {{"p50", 500}, {"p90", 900}, {"p99", 990}, {"p999", 999}};
+	int i;
+
+	if (impl.lat_cnt < 1) {
+		printf(" lat_cnt=0\n");
+		return;
+	}
+	qsort(impl.lat, impl.lat_cnt, sizeof(*impl.lat), &lat_cmp);
+	printf(" lat_cnt=%lu", impl.lat_cnt);
+	for (i = 0; i < (int)aloe_arraysize(pct); i++) {
+		printf(" lat_%s_ns=%lu", pct[i].name,
+				impl.lat[(impl.lat_cnt - 1) * pct[i].pm / 1000]);
+	}
+	printf(" lat_max_ns=%lu\n", impl.lat[impl.lat_cnt - 1]);
+}
+
+/**
+ * Put and cancel on random FD among fd_cnt registered.
+ *
+ * Register without IO event that backend not involved, only the cost to
+ * lookup and queue counted.
+ */
+static int bench_put_cancel(int fd_cnt) {
+	aloe_ev_cfg_t ev_cfg = {.backend = impl.ev_backend};
+	void *ctx, *ev;
+	unsigned long i, ns, alloc, seed = 1;
+	struct timespec ts0;
+	int r, fd;
+
+	if (!(ctx = aloe_ev_init2(&ev_cfg))) {
+		log_e("aloe_ev_init\n");
+		return ENOMEM;
+	}
+	for (fd = 0; fd < fd_cnt; fd++) {
+		if (!aloe_ev_put(ctx, fd, &bench_on_noti, NULL, 0,
+				ALOE_EV_INFINITE, 0)) {
+			r = ENOMEM;
+			log_e("register fd %d\n", fd);
+			goto finally;
+		}
+	}
+
+	alloc = impl.alloc;
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (i = 0; i < impl.iter; i++) {
+		fd = (int)(bench_rand(&seed) % fd_cnt);
+		if (!(ev = aloe_ev_put(ctx, fd, &bench_on_noti, NULL, 0,
+				ALOE_EV_INFINITE, 0))) {
+			r = ENOMEM;
+			log_e("put fd %d\n", fd);
+			goto finally;
+		}
+		aloe_ev_cancel(ctx, ev);
+	}
+	ns = bench_ns(&ts0);
+	alloc = impl.alloc - alloc;
+
+	printf("bench=put_cancel backend=%s fds=%d iter=%lu ns_per_op=%.1f "
+			"op_per_sec=%.0f alloc_per_iter=%.3f\n",
+			aloe_ev_backend(ctx), fd_cnt, impl.iter, (double)ns / impl.iter,
+			(double)impl.iter * 1000000000.0 / (ns ? ns : 1),
+			(double)alloc / impl.iter);
+	r = 0;
+finally:
+	aloe_ev_destroy(ctx);
+	return r;
+}
+
+/** Socket pair in io bench. */
+typedef struct {
+	int fd[2];
+	struct timespec ts; /**< When written. */
+	unsigned long noti;
+} bench_sock_t;
+
+static void bench_on_read(int fd, unsigned ev_noti, void *cbarg) {
+	bench_sock_t *sock = (bench_sock_t*)cbarg;
+	char buf[64];
+
+	lat_add(bench_ns(&sock->ts));
+	while (read(fd, buf, sizeof(buf)) > 0);
+	sock->noti++;
+}
+
+/** Busy poll statistics appended to the line. */
+static void spin_print(void *ctx) {
+	aloe_ev_spin_stat_t stat;
+
+	if (!impl.spin) return;
+	aloe_ev_spin_stat(ctx, &stat, 0);
+	printf(" spin_us=%lu spin=%lu spin_hit=%lu spin_ns=%lu spin_budget_ns=%lu",
+			impl.spin, stat.spin, stat.hit, stat.ns, stat.budget_ns);
+}
+
+/**
+ * Make rate among socks socket pair readable per loop.
+ *
+ * Readers registered persistent, latency from write to callback.
+ */
+static int bench_io(void) {
+	aloe_ev_cfg_t ev_cfg = {.backend = impl.ev_backend, .spin_us = impl.spin};
+	void *ctx;
+	bench_sock_t *sock = NULL;
+	unsigned long i, ns, alloc, noti, seed = 1;
+	struct timespec ts0;
+	int r, j, socks = 0;
+
+	if (!(ctx = aloe_ev_init2(&ev_cfg))) {
+		log_e("aloe_ev_init\n");
+		return ENOMEM;
+	}
+	if (!(sock = calloc(impl.socks, sizeof(*sock)))) {
+		r = ENOMEM;
+		log_e("malloc socket pair\n");
+		goto finally;
+	}
+	for (socks = 0; socks < impl.socks; socks++) {
+		bench_sock_t *s = &sock[socks];
+
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, s->fd) != 0) {
+			r = errno;
+			log_e("socketpair: %s(%d)\n", strerror(r), r);
+			goto finally;
+		}
+		aloe_file_nonblock(s->fd[0], 1);
+		if (!aloe_ev_put(ctx, s->fd[0], &bench_on_read, s,
+				aloe_ev_flag_read | aloe_ev_flag_persist, ALOE_EV_INFINITE, 0)) {
+			r = EIO;
+			close(s->fd[0]); close(s->fd[1]);
+			log_e("register socket pair %d\n", socks);
+			goto finally;
+		}
+	}
+	if ((r = lat_reset(impl.loops * impl.rate)) != 0) goto finally;
+
+	alloc = impl.alloc;
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (i = 0; i < impl.loops; i++) {
+		for (j = 0; j < impl.rate; j++) {
+			bench_sock_t *s = &sock[bench_rand(&seed) % socks];
+
+			clock_gettime(CLOCK_MONOTONIC, &s->ts);
+			if (write(s->fd[1], "x", 1) != 1) {
+				r = errno;
+				log_e("write: %s(%d)\n", strerror(r), r);
+				goto finally;
+			}
+		}
+		if ((r = aloe_ev_once(ctx)) != 0) {
+			log_e("aloe_ev_once: %s(%d)\n", strerror(r), r);
+			goto finally;
+		}
+	}
+	ns = bench_ns(&ts0);
+	alloc = impl.alloc - alloc;
+	for (noti = 0, j = 0; j < socks; j++) noti += sock[j].noti;
+
+	printf("bench=io backend=%s fds=%d rate=%d loops=%lu ev=%lu "
+			"ev_per_sec=%.0f ns_per_loop=%.1f alloc_per_iter=%.3f",
+			aloe_ev_backend(ctx), socks, impl.rate, impl.loops, noti,
+			(double)noti * 1000000000.0 / (ns ? ns : 1),
+			(double)ns / impl.loops, (double)alloc / impl.loops);
+	spin_print(ctx);
+	lat_print();
+	r = 0;
+finally:
+	aloe_ev_destroy(ctx);
+	if (sock) {
+		for (j = 0; j < socks; j++) {
+			close(sock[j].fd[0]);
+			close(sock[j].fd[1]);
+		}
+		free(sock);
+	}
+	return r;
+}
+
+/** Timer in timer bench. */
+typedef struct {
+	struct timespec due;
+	unsigned long intv; /**< Micro-seconds. */
+	unsigned long noti;
+	void *ctx;
+} bench_tmr_t;
+
+static void bench_on_tmr(int fd, unsigned ev_noti, void *cbarg) {
+	bench_tmr_t *tmr = (bench_tmr_t*)cbarg;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	lat_add((ts.tv_sec - tmr->due.tv_sec) * 1000000000ul + ts.tv_nsec
+			- tmr->due.tv_nsec);
+	tmr->noti++;
+	// persistent timer rearm from loop time
+	ts = *aloe_ev_now(tmr->ctx);
+	ALOE_TIMESEC_ADD(ts.tv_sec, ts.tv_nsec, 0, tmr->intv * 1000ul,
+			tmr->due.tv_sec, tmr->due.tv_nsec, 1000000000ul);
+}
+
+/**
+ * Run tmrs persistent timer with interval 1 to 10 milli-seconds for dur.
+ *
+ * Latency as timer overshoot.
+ */
+static int bench_timer(void) {
+	aloe_ev_cfg_t ev_cfg = {.backend = impl.ev_backend, .spin_us = impl.spin};
+	void *ctx;
+	bench_tmr_t *tmr = NULL;
+	unsigned long ns, alloc, loops, noti, seed = 1;
+	struct timespec ts0;
+	int r, j;
+
+	if (!(ctx = aloe_ev_init2(&ev_cfg))) {
+		log_e("aloe_ev_init\n");
+		return ENOMEM;
+	}
+	if (!(tmr = calloc(impl.tmrs, sizeof(*tmr)))) {
+		r = ENOMEM;
+		log_e("malloc timer\n");
+		goto finally;
+	}
+	// sample expected to fire in duration
+	if ((r = lat_reset(impl.tmrs * impl.dur + 1)) != 0) goto finally;
+	for (j = 0; j < impl.tmrs; j++) {
+		bench_tmr_t *t = &tmr[j];
+
+		t->intv = 1000ul + bench_rand(&seed) % 9001ul;
+		t->ctx = ctx;
+		t->due = *aloe_ev_now(ctx);
+		ALOE_TIMESEC_ADD(t->due.tv_sec, t->due.tv_nsec, 0, t->intv * 1000ul,
+				t->due.tv_sec, t->due.tv_nsec, 1000000000ul);
+		if (!aloe_ev_put(ctx, -1, &bench_on_tmr, t, aloe_ev_flag_persist,
+				0, t->intv)) {
+			r = ENOMEM;
+			log_e("register timer %d\n", j);
+			goto finally;
+		}
+	}
+
+	alloc = impl.alloc;
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (loops = 0; (ns = bench_ns(&ts0)) < impl.dur * 1000000ul; loops++) {
+		if ((r = aloe_ev_once(ctx)) != 0) {
+			log_e("aloe_ev_once: %s(%d)\n", strerror(r), r);
+			goto finally;
+		}
+	}
+	alloc = impl.alloc - alloc;
+	for (noti = 0, j = 0; j < impl.tmrs; j++) noti += tmr[j].noti;
+
+	printf("bench=timer backend=%s tmrs=%d dur_ms=%lu loops=%lu ev=%lu "
+			"ev_per_sec=%.0f alloc_per_iter=%.3f",
+			aloe_ev_backend(ctx), impl.tmrs, impl.dur, loops, noti,
+			(double)noti * 1000000000.0 / (ns ? ns : 1),
+			(double)alloc / (loops ? loops : 1));
+	spin_print(ctx);
+	lat_print();
+	r = 0;
+finally:
+	aloe_ev_destroy(ctx);
+	if (tmr) free(tmr);
+	return r;
+}
+
+static const char opt_short[] = "hb:n:m:s:r:l:t:d:p:";
+static struct option opt_long[] = {
+	{"help", no_argument, NULL, 'h'},
+	{"backend", required_argument, NULL, 'b'},
+	{"iter", required_argument, NULL, 'n'},
+	{"mode", required_argument, NULL, 'm'},
+	{"socks", required_argument, NULL, 's'},
+	{"rate", required_argument, NULL, 'r'},
+	{"loops", required_argument, NULL, 'l'},
+	{"timers", required_argument, NULL, 't'},
+	{"duration", required_argument, NULL, 'd'},
+	{"spin", required_argument, NULL, 'p'},
+	{0},
+};
+
+static void help(int argc, char **argv) {
+	fprintf(stdout,
+"COMMAND\n"
+"    %s [OPTIONS] [FDS...]\n"
+"\n"
+"    Benchmark event loop, one line of key=value per run\n"
+"\n"
+"    put_cancel: aloe_ev_put() and aloe_ev_cancel() with FDS registered\n"
+"                (default 10 1000 50000)\n"
+"    io:         persistent read on socket pairs, latency from write to\n"
+"                callback\n"
+"    timer:      persistent timers in 1 to 10 milli-seconds, latency as\n"
+"                overshoot\n"
+"\n"
+"OPTIONS\n"
+"    -h, --help         Show help\n"
+"    -b, --backend=<NAME>\n"
+"                       Event backend, epoll or select(first workable)\n"
+"    -m, --mode=<MODE>  Run put_cancel, io or timer, comma separated(all)\n"
+"    -n, --iter=<N>     Put and cancel per run(%lu)\n"
+"    -s, --socks=<N>    Socket pair for io(%d)\n"
+"    -r, --rate=<N>     Socket pair made readable per loop for io(%d)\n"
+"    -l, --loops=<N>    Loop for io(%lu)\n"
+"    -t, --timers=<N>   Timer for timer(%d)\n"
+"    -d, --duration=<MS>\n"
+"                       Milli-seconds for timer(%lu)\n"
+"    -p, --spin=<US>    Busy poll before sleep for io and timer(%lu)\n"
+"\n",
+		((argc > 0) && argv && argv[0] ? argv[0] : "Program"), impl.iter,
+		impl.socks, impl.rate, impl.loops, impl.tmrs, impl.dur, impl.spin);
+}
+
+int main(int argc, char **argv) {
+	int opt_op, opt_idx, r = 0, i;
+	static const int fd_cnt_def[] = {10, 1000, 50000};
+	const char *mode = "put_cancel,io,timer";
+
+	optind = 0;
+	while ((opt_op = getopt_long(argc, argv, opt_short, opt_long,
+			&opt_idx)) != -1) {
+		if (opt_op == 'h') {
+			help(argc, argv);
+			return 1;
+		}
+		if (opt_op == 'b') {
+			impl.ev_backend = optarg;
+			continue;
+		}
+		if (opt_op == 'n') {
+			impl.iter = strtoul(optarg, NULL, 0);
+			continue;
+		}
+		if (opt_op == 'm') {
+			mode = optarg;
+			continue;
+		}
+		if (opt_op == 's') {
+			impl.socks = strtol(optarg, NULL, 0);
+			continue;
+		}
+		if (opt_op == 'r') {
+			impl.rate = strtol(optarg, NULL, 0);
+			continue;
+		}
+		if (opt_op == 'l') {
+			impl.loops = strtoul(optarg, NULL, 0);
+			continue;
+		}
+		if (opt_op == 't') {
+			impl.tmrs = strtol(optarg, NULL, 0);
+			continue;
+		}
+		if (opt_op == 'd') {
+			impl.dur = strtoul(optarg, NULL, 0);
+			continue;
+		}
+		if (opt_op == 'p') {
+			impl.spin = strtoul(optarg, NULL, 0);
+			continue;
+		}
+	}
+	if (impl.iter < 1) impl.iter = 1;
+	if (impl.socks < 1) impl.socks = 1;
+	if (impl.rate < 1) impl.rate = 1;
+	if (impl.loops < 1) impl.loops = 1;
+	if (impl.tmrs < 1) impl.tmrs = 1;
+	if (impl.dur < 1) impl.dur = 1;
+
+	if (strstr(mode, "put_cancel")) {
+		if (optind < argc) {
+			for (i = optind; i < argc; i++) {
+				int fd_cnt = strtol(argv[i], NULL, 0);
+
+				if (fd_cnt < 1) continue;
+				if ((r = bench_put_cancel(fd_cnt)) != 0) goto finally;
+			}
+		} else {
+			for (i = 0; i < (int)aloe_arraysize(fd_cnt_def); i++) {
+				if ((r = bench_put_cancel(fd_cnt_def[i])) != 0) goto finally;
+			}
+		}
+	}
+	if (strstr(mode, "io") && (r = bench_io()) != 0) goto finally;
+	if (strstr(mode, "timer") && (r = bench_timer()) != 0) goto finally;
+finally:
+	if (impl.lat) free(impl.lat);
+	return r;
+}
@@ -0,0 +1,304 @@
+/**
+ * @author joelai
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "priv.h"
+
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+static struct {
+	int fail;
+	aloe_ring_t ring; /**< Shared by spsc producer and consumer. */
+	unsigned spsc_cnt; /**< Word passed through spsc ring. */
+} impl = {.spsc_cnt = 200000u};
+
+#define buf_check(_c) if (!(_c)) { \
+	log_e("check failed: %s\n", #_c); \
+	impl.fail++; \
+}
+
+__attribute__((format(printf, 4, 5)))
+int log_printf(const char *lvl, const char *func_name, int lno,
+		const char *fmt, ...) {
+	int r;
+	va_list va;
+
+	if ((int)(unsigned long)lvl != log_level_err) return 0;
+	fprintf(stderr, "[%s][#%d]", func_name, lno);
+	va_start(va, fmt);
+	r = vfprintf(stderr, fmt, va);
+	va_end(va);
+	return r;
+}
+
+/** Byte in sequence to tell the order. */
+#define seq_byte(_i) ((unsigned char)((_i) * 7 + 3))
+
+static void* spsc_producer(void *arg) {
+	unsigned buf[37], i = 0;
+
+	while (i < impl.spsc_cnt) {
+		size_t cnt = aloe_min(1 + i % 37, impl.spsc_cnt - i), k, w;
+
+		for (k = 0; k < cnt; k++) buf[k] = i + k;
+		// whole word only, spare counted in byte
+		cnt = aloe_min(cnt, aloe_ring_spare(&impl.ring) / sizeof(buf[0]));
+		if (cnt == 0) {
+			sched_yield();
+			continue;
+		}
+		w = aloe_ring_write(&impl.ring, buf, cnt * sizeof(buf[0]));
+		i += w / sizeof(buf[0]);
+	}
+	return NULL;
+}
+
+static void test_ring(void) {
+	unsigned char b[16];
+	unsigned v[64], exp = 0;
+	pthread_t thread;
+	size_t r, i;
+
+	// wraparound in single thread
+	buf_check(aloe_ring_init(&impl.ring, 5, 0) == 0);
+	buf_check(aloe_ring_cap(&impl.ring) == 8);
+	buf_check(aloe_ring_write(&impl.ring, "abcdef", 6) == 6);
+	buf_check(aloe_ring_read(&impl.ring, b, 4) == 4 && memcmp(b, "abcd", 4) == 0);
+	buf_check(aloe_ring_write(&impl.ring, "ghijklmn", 8) == 6);
+	buf_check(aloe_ring_len(&impl.ring) == 8 && aloe_ring_spare(&impl.ring) == 0);
+	buf_check(aloe_ring_read(&impl.ring, b, sizeof(b)) == 8
+			&& memcmp(b, "efghijkl", 8) == 0);
+	aloe_ring_destroy(&impl.ring);
+
+	// wraparound many times by the producer thread
+	buf_check(aloe_ring_init(&impl.ring, 4096, aloe_ring_flag_spsc) == 0);
+	if (pthread_create(&thread, NULL, &spsc_producer, NULL) != 0) {
+		log_e("Failed create producer\n");
+		impl.fail++;
+		aloe_ring_destroy(&impl.ring);
+		return;
+	}
+	while (exp < impl.spsc_cnt) {
+		if ((r = aloe_ring_read(&impl.ring, v, sizeof(v))) == 0) {
+			sched_yield();
+			continue;
+		}
+		buf_check(r % sizeof(v[0]) == 0);
+		for (i = 0; i < r / sizeof(v[0]); i++, exp++) {
+			if (v[i] != exp) {
+				log_e("spsc expect %u but %u\n", exp, v[i]);
+				impl.fail++;
+				exp = impl.spsc_cnt;
+				break;
+			}
+		}
+	}
+	pthread_join(thread, NULL);
+	aloe_ring_destroy(&impl.ring);
+}
+
+static void test_ring_peek(void) {
+	aloe_ring_t ring;
+	char *p, b[4000];
+	size_t sz;
+
+	// not mirrored, located till the wrap
+	buf_check(aloe_ring_init(&ring, 8, 0) == 0);
+	aloe_ring_write(&ring, "abcdef", 6);
+	aloe_ring_read(&ring, b, 5);
+	p = (char*)aloe_ring_write_peek(&ring, &sz);
+	buf_check(sz == 2);
+	aloe_ring_write(&ring, "ghij", 4);
+	p = (char*)aloe_ring_read_peek(&ring, &sz);
+	buf_check(sz == 3 && memcmp(p, "fgh", 3) == 0);
+	aloe_ring_destroy(&ring);
+
+#if HAVE_DECL___NR_MEMFD_CREATE
+	// mirrored, located across the wrap
+	buf_check(aloe_ring_init(&ring, 100, aloe_ring_flag_mirror) == 0);
+	buf_check(aloe_ring_cap(&ring) == 4096);
+	memset(b, 'a', sizeof(b));
+	buf_check(aloe_ring_write(&ring, b, sizeof(b)) == sizeof(b));
+	buf_check(aloe_ring_read(&ring, NULL, 3990) == 3990);
+	p = (char*)aloe_ring_write_peek(&ring, &sz);
+	buf_check(sz == 4086);
+	memset(p, 'b', 200);
+	aloe_ring_write_commit(&ring, 200);
+	p = (char*)aloe_ring_read_peek(&ring, &sz);
+	buf_check(sz == 210 && memcmp(p, "aaaaaaaaaabbbb", 14) == 0
+			&& p[209] == 'b');
+	// the part over the boundary seen at start of the memory
+	buf_check(((char*)ring.data)[103] == 'b');
+	aloe_ring_read_commit(&ring, 210);
+	buf_check(aloe_ring_len(&ring) == 0);
+	aloe_ring_destroy(&ring);
+#endif
+}
+
+static void test_rinbuf_fd(void) {
+	unsigned char mem[8], out[16], big[1 << 16];
+	aloe_buf_t buf = {.data = mem, .cap = sizeof(mem), .pos = 6, .lmt = 0};
+	int fd[2] = {-1, -1}, sv[2] = {-1, -1}, i;
+	size_t len;
+	ssize_t r;
+
+	if (pipe(fd) != 0) {
+		log_e("pipe: %s(%d)\n", strerror(errno), errno);
+		impl.fail++;
+		goto finally;
+	}
+
+	// less than spare across the wrap
+	buf_check(write(fd[1], "abc", 3) == 3);
+	buf_check(aloe_rinbuf_readv_fd(&buf, fd[0]) == 3 && buf.lmt == 3);
+	buf_check(mem[6] == 'a' && mem[7] == 'b' && mem[0] == 'c');
+
+	// more than spare, the rest left in pipe
+	buf_check(write(fd[1], "defghij", 7) == 7);
+	buf_check(aloe_rinbuf_readv_fd(&buf, fd[0]) == 5 && buf.lmt == 8);
+	buf_check(aloe_rinbuf_readv_fd(&buf, fd[0]) == -1 && errno == ENOBUFS);
+	buf_check(aloe_rinbuf_writev_fd(&buf, fd[1]) == 8 && buf.lmt == 0
+			&& buf.pos == 6);
+	buf_check(read(fd[0], out, sizeof(out)) == 10
+			&& memcmp(out, "ijabcdefgh", 10) == 0);
+
+	// socket take part of wrapped data
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+		log_e("socketpair: %s(%d)\n", strerror(errno), errno);
+		impl.fail++;
+		goto finally;
+	}
+	i = 4096;
+	setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &i, sizeof(i));
+	aloe_file_nonblock(sv[0], 1);
+	buf = (aloe_buf_t){.data = big, .cap = sizeof(big),
+			.pos = sizeof(big) - 100, .lmt = sizeof(big)};
+	for (i = 0; i < (int)sizeof(big); i++) {
+		big[(buf.pos + i) % buf.cap] = seq_byte(i);
+	}
+	r = aloe_rinbuf_writev_fd(&buf, sv[0]);
+	buf_check(r > 100 && (size_t)r < sizeof(big));
+	buf_check(buf.lmt == sizeof(big) - (size_t)r
+			&& buf.pos == (size_t)r - 100);
+
+	// remained data in order
+	aloe_file_nonblock(sv[1], 1);
+	for (len = 0; len < sizeof(big); ) {
+		if ((r = read(sv[1], out, sizeof(out))) > 0) {
+			for (i = 0; i < r; i++) {
+				if (out[i] != seq_byte(len + i)) break;
+			}
+			if (i < r) {
+				log_e("socket data mismatch at %d\n", (int)len + i);
+				impl.fail++;
+				break;
+			}
+			len += r;
+			continue;
+		}
+		if ((r = aloe_rinbuf_writev_fd(&buf, sv[0])) < 0
+				&& !ALOE_ENO_NONBLOCKING(errno)) {
+			log_e("writev: %s(%d)\n", strerror(errno), errno);
+			impl.fail++;
+			break;
+		}
+	}
+	buf_check(len == sizeof(big) && buf.lmt == 0);
+finally:
+	if (fd[0] != -1) close(fd[0]);
+	if (fd[1] != -1) close(fd[1]);
+	if (sv[0] != -1) close(sv[0]);
+	if (sv[1] != -1) close(sv[1]);
+}
+
+static void test_vaprintf(void) {
+	aloe_buf_t buf = {.data = NULL};
+	void *data;
+	int i;
+
+	// fit in spare, no reallocate
+	buf_check(aloe_buf_expand(&buf, 64, aloe_buf_flag_none) == 0);
+	aloe_buf_clear(&buf);
+	data = buf.data;
+	buf_check(aloe_buf_aprintf(&buf, -1, "%s", "0123456789") == 10);
+	buf_check(buf.data == data && buf.cap == 64 && buf.pos == 10);
+
+	// grow and keep former
+	buf_check(aloe_buf_aprintf(&buf, -1, "%100d", 1) == 100);
+	buf_check(buf.cap >= 111 && buf.pos == 110
+			&& memcmp(buf.data, "0123456789 ", 11) == 0
+			&& ((char*)buf.data)[109] == '1' && ((char*)buf.data)[110] == '\0');
+
+	// over limit, left untouched
+	buf_check(aloe_buf_aprintf(&buf, buf.cap, "%*d", (int)buf.cap, 1) == -1);
+	buf_check(buf.pos == 110);
+
+	// grow geometric
+	for (i = 0; i < 1000; i++) {
+		buf_check(aloe_buf_aprintf(&buf, -1, "%d,", i) > 0);
+	}
+	buf_check(buf.pos == 110 + 3890 && ((char*)buf.data)[buf.pos] == '\0');
+	free(buf.data);
+
+	// empty start, limit at exact size
+	buf = (aloe_buf_t){.data = NULL};
+	aloe_buf_clear(&buf);
+	buf_check(aloe_buf_aprintf(&buf, 10, "%s", "0123456789") == -1);
+	buf_check(aloe_buf_aprintf(&buf, 11, "%s", "0123456789") == 10
+			&& buf.cap == 11);
+	free(buf.data);
+}
+
+static void test_pool(void) {
+	aloe_buf_pool_stat_t stat[ALOE_BUF_POOL_CLASS + 1];
+	aloe_buf_t buf[8];
+	void *data;
+	int i;
+
+	aloe_buf_pool_stat(NULL, 0, 1);
+
+	// capacity round up to class, larger from malloc
+	buf_check(aloe_buf_acquire(&buf[0], 500) == 0 && buf[0].cap == 512
+			&& buf[0].lmt == 512 && buf[0].pos == 0);
+	buf_check(aloe_buf_acquire(&buf[1], 1) == 0 && buf[1].cap == 64);
+	buf_check(aloe_buf_acquire(&buf[2], 65536) == 0 && buf[2].cap == 65536);
+	buf_check(aloe_buf_acquire(&buf[3], 65537) == 0 && buf[3].cap == 65537);
+	data = buf[0].data;
+	for (i = 0; i < 4; i++) aloe_buf_release(&buf[i]);
+	buf_check(!buf[0].data && buf[0].cap == 0);
+
+	// same class reused
+	buf_check(aloe_buf_acquire(&buf[0], 300) == 0 && buf[0].data == data);
+	aloe_buf_release(&buf[0]);
+	buf_check(aloe_buf_pool_stat(stat, ALOE_BUF_POOL_CLASS + 1, 1)
+			== ALOE_BUF_POOL_CLASS + 1);
+	buf_check(stat[3].cap == 512 && stat[3].hit == 1 && stat[3].miss == 1
+			&& stat[3].release == 2 && stat[3].spare == 1);
+	buf_check(stat[ALOE_BUF_POOL_CLASS].cap == 0
+			&& stat[ALOE_BUF_POOL_CLASS].miss == 1
+			&& stat[ALOE_BUF_POOL_CLASS].drop == 1);
+
+	// spare bounded per class
+	for (i = 0; i < 8; i++) aloe_buf_acquire(&buf[i], 65536);
+	for (i = 0; i < 8; i++) aloe_buf_release(&buf[i]);
+	aloe_buf_pool_stat(stat, ALOE_BUF_POOL_CLASS + 1, 0);
+	buf_check(stat[10].spare == 4 && stat[10].drop == 4);
+	aloe_buf_pool_clean();
+}
+
+int main(int argc, char **argv) {
+	test_ring();
+	test_ring_peek();
+	test_rinbuf_fd();
+	test_vaprintf();
+	test_pool();
+	printf("%s\n", impl.fail ? "fail" : "pass");
+	return impl.fail ? 1 : 0;
+}
@@ -44,15 +44,14 @@ static aloe_cfg_t* cfg_rb_find(aloe_cfg_rbtree_t *rbtree, const char *_key) {
 static void cfg_reset_val(aloe_cfg_t *cfg) {
 	if (cfg->type == aloe_cfg_type_data ||
 			cfg->type == aloe_cfg_type_string) {
-		aloe_buf_t *fb = (aloe_buf_t*)&cfg->val;
-		if (fb->data) free(fb->data);
+		aloe_buf_release((aloe_buf_t*)&cfg->val);
 	}
 	cfg->type = aloe_cfg_type_void;
 }
 
 static void cfg_free(aloe_cfg_t *cfg) {
 	cfg_reset_val(cfg);
-	if (cfg->fb_key.data) free(cfg->fb_key.data);
+	aloe_buf_release(&cfg->fb_key);
 	free(cfg);
 }
 
@@ -94,7 +93,10 @@ static int cfg_set_val(aloe_cfg_t *cfg, aloe_cfg_type_t type, va_list va) {
 			break;
 		}
 		sz = va_arg(va, size_t);
-		if (aloe_buf_expand(buf, sz + 1, 0) != 0) return ENOMEM;
+		if (buf->cap < sz + 1) {
+			aloe_buf_release(buf);
+			if (aloe_buf_acquire(buf, sz + 1) != 0) return ENOMEM;
+		}
 		memcpy(buf->data, data, sz);
 		((char*)buf->data)[buf->lmt = sz] = '\0';
 		break;
@@ -105,7 +107,7 @@ static int cfg_set_val(aloe_cfg_t *cfg, aloe_cfg_type_t type, va_list va) {
 		const void *fmt = va_arg(va, const void*);
 
 		aloe_buf_clear(buf);
-		if (aloe_buf_aprintf(buf, -1, fmt, va) < 0) return ENOMEM;
+		if (aloe_buf_vaprintf(buf, -1, fmt, va) < 0) return ENOMEM;
 		aloe_buf_flip(buf);
 		break;
 	}
@@ -11,51 +11,283 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <time.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#  include <sys/eventfd.h>
+#endif
+#ifdef HAVE_SYS_PRCTL_H
+#  include <sys/prctl.h>
+#endif
 
- /** Minimal due time for select(), value in micro-seconds. */
+ /** Minimal due time for backend, value in micro-seconds. */
 #define ALOE_EV_PREVENT_BUSY_WAITING 1001ul
 
-static aloe_ev_ctx_fd_t* fd_q_find(aloe_ev_ctx_fd_queue_t *q, int fd, char pop) {
-	aloe_ev_ctx_fd_t *ev_fd;
+/** Children per node of timer heap. */
+#define ALOE_EV_TMR_HEAP_D 4
 
-	if (fd == -1) {
-		if ((ev_fd = TAILQ_FIRST(q)) && pop) {
-			TAILQ_REMOVE(q, ev_fd, qent);
+/** Event monitored by backend. */
+#define ALOE_EV_FLAG_IO (aloe_ev_flag_read | aloe_ev_flag_write | \
+		aloe_ev_flag_except)
+
+/** Event and trigger mode passed to backend. */
+#define ALOE_EV_FLAG_BACKEND (ALOE_EV_FLAG_IO | aloe_ev_flag_edge)
+
+static const aloe_ev_backend_t *backend_lut[] = {
+#ifdef WITH_EPOLL
+	&aloe_ev_backend_epoll,
+#endif
+	&aloe_ev_backend_select,
+	NULL
+};
+
+/** Lookup monitored FD. */
+static aloe_ev_ctx_fd_t* fd_tbl_find(aloe_ev_ctx_t *ctx, int fd) {
+	return (fd >= 0 && fd < ctx->fd_tbl_cap) ? ctx->fd_tbl[fd] : NULL;
+}
+
+/** Prepare room in table for the FD. */
+static int fd_tbl_reserve(aloe_ev_ctx_t *ctx, int fd) {
+	aloe_ev_ctx_fd_t **fd_tbl;
+	int cap;
+
+	if (fd < ctx->fd_tbl_cap) return 0;
+	cap = ctx->fd_tbl_cap ? ctx->fd_tbl_cap : 64;
+	while (cap <= fd) cap *= 2;
+	if (!(fd_tbl = realloc(ctx->fd_tbl, cap * sizeof(*fd_tbl)))) return ENOMEM;
+	memset(fd_tbl + ctx->fd_tbl_cap, 0,
+			(cap - ctx->fd_tbl_cap) * sizeof(*fd_tbl));
+	ctx->fd_tbl = fd_tbl;
+	ctx->fd_tbl_cap = cap;
+	return 0;
+}
+
+/** Queue the FD to revise monitored event or release later. */
+static void fd_chg(aloe_ev_ctx_t *ctx, aloe_ev_ctx_fd_t *ev_fd) {
+	if (ev_fd->flag.chg) return;
+	if (ctx->chg_cnt >= ctx->chg_cap) {
+		int cap = ctx->chg_cap ? ctx->chg_cap * 2 : 32;
+		aloe_ev_ctx_fd_t **chg;
+
+		if (!(chg = realloc(ctx->chg, cap * sizeof(*chg)))) {
+			// stale monitoring only cause extra wakeup
+			log_e("malloc fd change list\n");
+			return;
 		}
-		return ev_fd;
+		ctx->chg = chg;
+		ctx->chg_cap = cap;
 	}
+	ctx->chg[ctx->chg_cnt++] = ev_fd;
+	ev_fd->flag.chg = 1;
+}
+
+/**
+ * Reduce monitored event and release empty FD.
+ *
+ * Defer to next wait that callback usually put again the event just notified.
+ */
+static void fd_chg_flush(aloe_ev_ctx_t *ctx) {
+	int i;
+
+	for (i = 0; i < ctx->chg_cnt; i++) {
+		aloe_ev_ctx_fd_t *ev_fd = ctx->chg[i];
+		aloe_ev_ctx_noti_t *ev_noti;
+		unsigned ev_wait = 0;
 
-	TAILQ_FOREACH(ev_fd, q, qent) {
-		if (ev_fd->fd == fd) return ev_fd;
+		ev_fd->flag.chg = 0;
+
+		// notify deferred by budget, revise after dispatched
+		if (ev_fd->noti_rdy > 0) {
+			ev_fd->flag.chg_defer = 1;
+			continue;
+		}
+		TAILQ_FOREACH(ev_noti, &ev_fd->noti_q, qent) {
+			ev_wait |= (ev_noti->ev_wait & ALOE_EV_FLAG_BACKEND);
+		}
+		if (!(ev_wait & ALOE_EV_FLAG_IO)) ev_wait = 0;
+		if (ev_wait != ev_fd->ev_reg) {
+			(*ctx->backend->ctl)(ctx, ev_fd, ev_wait);
+			ev_fd->ev_reg = ev_wait;
+		}
+		if (TAILQ_EMPTY(&ev_fd->noti_q)) {
+			ctx->fd_tbl[ev_fd->fd] = NULL;
+			TAILQ_REMOVE(&ctx->fd_q, ev_fd, qent);
+			aloe_ev_pool_put(&ctx->fd_pool, ev_fd);
+			ctx->fd_cnt--;
+		}
 	}
-	return NULL;
+	ctx->chg_cnt = 0;
 }
 
-static aloe_ev_ctx_noti_t* noti_q_find(aloe_ev_ctx_noti_queue_t *q,
-		const aloe_ev_ctx_noti_t *_ev_noti, char pop) {
-	aloe_ev_ctx_noti_t *ev_noti;
+/** Order timer heap by due. */
+#define tmr_lt(_a, _b) (ALOE_TIMESEC_CMP((_a)->due.tv_sec, (_a)->due.tv_nsec, \
+		(_b)->due.tv_sec, (_b)->due.tv_nsec) < 0)
+
+static void tmr_set(aloe_ev_ctx_t *ctx, int idx, aloe_ev_ctx_noti_t *ev_noti) {
+	ctx->tmr[idx] = ev_noti;
+	ev_noti->tmr_idx = idx;
+}
+
+static void tmr_up(aloe_ev_ctx_t *ctx, int idx) {
+	aloe_ev_ctx_noti_t *ev_noti = ctx->tmr[idx];
+
+	while (idx > 0) {
+		int parent = (idx - 1) / ALOE_EV_TMR_HEAP_D;
+
+		if (!tmr_lt(ev_noti, ctx->tmr[parent])) break;
+		tmr_set(ctx, idx, ctx->tmr[parent]);
+		idx = parent;
+	}
+	tmr_set(ctx, idx, ev_noti);
+}
+
+static void tmr_down(aloe_ev_ctx_t *ctx, int idx) {
+	aloe_ev_ctx_noti_t *ev_noti = ctx->tmr[idx];
 
-	if (!_ev_noti) {
-		if ((ev_noti = TAILQ_FIRST(q)) && pop) {
-			TAILQ_REMOVE(q, ev_noti, qent);
+	while (1) {
+		int child = idx * ALOE_EV_TMR_HEAP_D + 1, min = -1, i;
+
+		for (i = 0; i < ALOE_EV_TMR_HEAP_D && child + i < ctx->tmr_cnt; i++) {
+			if (min == -1 || tmr_lt(ctx->tmr[child + i], ctx->tmr[min])) {
+				min = child + i;
+			}
 		}
-		return ev_noti;
+		if (min == -1 || !tmr_lt(ctx->tmr[min], ev_noti)) break;
+		tmr_set(ctx, idx, ctx->tmr[min]);
+		idx = min;
 	}
+	tmr_set(ctx, idx, ev_noti);
+}
 
-	TAILQ_FOREACH(ev_noti, q, qent) {
-		if (ev_noti == _ev_noti) return ev_noti;
+/** Prepare room to add timer. */
+static int tmr_reserve(aloe_ev_ctx_t *ctx) {
+	aloe_ev_ctx_noti_t **tmr;
+	int cap;
+
+	if (ctx->tmr_cnt < ctx->tmr_cap) return 0;
+	cap = ctx->tmr_cap ? ctx->tmr_cap * 2 : 64;
+	if (!(tmr = realloc(ctx->tmr, cap * sizeof(*tmr)))) return ENOMEM;
+	ctx->tmr = tmr;
+	ctx->tmr_cap = cap;
+	return 0;
+}
+
+/** Add timer, must tmr_reserve() before. */
+static void tmr_add(aloe_ev_ctx_t *ctx, aloe_ev_ctx_noti_t *ev_noti) {
+	tmr_set(ctx, ctx->tmr_cnt++, ev_noti);
+	tmr_up(ctx, ev_noti->tmr_idx);
+}
+
+static void tmr_del(aloe_ev_ctx_t *ctx, aloe_ev_ctx_noti_t *ev_noti) {
+	int idx = ev_noti->tmr_idx;
+
+	if (idx < 0) return;
+	ev_noti->tmr_idx = -1;
+	if (idx == --ctx->tmr_cnt) return;
+	tmr_set(ctx, idx, ctx->tmr[ctx->tmr_cnt]);
+	if (idx > 0 && tmr_lt(ctx->tmr[idx],
+			ctx->tmr[(idx - 1) / ALOE_EV_TMR_HEAP_D])) {
+		tmr_up(ctx, idx);
+	} else {
+		tmr_down(ctx, idx);
 	}
-	return NULL;
+}
+
+/** Link to queue for the state. */
+static void noti_link(aloe_ev_ctx_t *ctx, aloe_ev_ctx_noti_t *ev_noti,
+		aloe_ev_noti_state_t state) {
+	switch (ev_noti->state = state) {
+	case aloe_ev_noti_state_spare:
+		aloe_ev_pool_put(&ctx->noti_pool, ev_noti);
+		break;
+	case aloe_ev_noti_state_fd:
+		TAILQ_INSERT_TAIL(&ev_noti->ev_fd->noti_q, ev_noti, qent);
+		break;
+	case aloe_ev_noti_state_tmr:
+		TAILQ_INSERT_TAIL(&ctx->tmr_q, ev_noti, qent);
+		break;
+	case aloe_ev_noti_state_ready:
+		TAILQ_INSERT_TAIL(&ctx->noti_q[ev_noti->prio], ev_noti, qent);
+		if (ev_noti->ev_fd) ev_noti->ev_fd->noti_rdy++;
+		break;
+	case aloe_ev_noti_state_defer:
+		TAILQ_INSERT_TAIL(&ctx->defer_q, ev_noti, qent);
+		break;
+	case aloe_ev_noti_state_idle:
+		TAILQ_INSERT_TAIL(&ctx->idle_q, ev_noti, qent);
+		break;
+	default:
+		break;
+	}
+}
+
+/** Unlink from queue for the state and timer heap. */
+static void noti_unlink(aloe_ev_ctx_t *ctx, aloe_ev_ctx_noti_t *ev_noti) {
+	tmr_del(ctx, ev_noti);
+	switch (ev_noti->state) {
+	case aloe_ev_noti_state_fd:
+		TAILQ_REMOVE(&ev_noti->ev_fd->noti_q, ev_noti, qent);
+		if (TAILQ_EMPTY(&ev_noti->ev_fd->noti_q)) fd_chg(ctx, ev_noti->ev_fd);
+		break;
+	case aloe_ev_noti_state_tmr:
+		TAILQ_REMOVE(&ctx->tmr_q, ev_noti, qent);
+		break;
+	case aloe_ev_noti_state_ready:
+		TAILQ_REMOVE(&ctx->noti_q[ev_noti->prio], ev_noti, qent);
+		if (ev_noti->ev_fd && --ev_noti->ev_fd->noti_rdy <= 0
+				&& ev_noti->ev_fd->flag.chg_defer) {
+			ev_noti->ev_fd->flag.chg_defer = 0;
+			fd_chg(ctx, ev_noti->ev_fd);
+		}
+		break;
+	case aloe_ev_noti_state_defer:
+		TAILQ_REMOVE(&ctx->defer_q, ev_noti, qent);
+		break;
+	case aloe_ev_noti_state_idle:
+		TAILQ_REMOVE(&ctx->idle_q, ev_noti, qent);
+		break;
+	default:
+		break;
+	}
+	ev_noti->state = aloe_ev_noti_state_none;
+}
+
+int aloe_ev_now_update(void *_ctx) {
+	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)_ctx;
+	int r;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ctx->now) == 0) return 0;
+	r = errno;
+	log_e("Failed to get time: %s(%d)\n", strerror(r), r);
+	return r;
+}
+
+const struct timespec* aloe_ev_now(void *_ctx) {
+	return &((aloe_ev_ctx_t*)_ctx)->now;
+}
+
+/** Time to count timeout from, errno when failed. */
+static int now_get(aloe_ev_ctx_t *ctx, struct timespec *ts) {
+	int r;
+
+	if (ctx->flag.precise && (r = aloe_ev_now_update(ctx)) != 0) return r;
+	*ts = ctx->now;
+	return 0;
 }
 
 void* aloe_ev_get(void *_ctx, int fd, aloe_ev_noti_cb_t cb) {
 	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)_ctx;
 	aloe_ev_ctx_fd_t *ev_fd;
 	aloe_ev_ctx_noti_t *ev_noti;
+	aloe_ev_ctx_noti_queue_t *q;
 
-	if (!(ev_fd = fd_q_find(&ctx->fd_q, fd, 0))) return NULL;
+	if (fd == -1) {
+		q = &ctx->tmr_q;
+	} else if ((ev_fd = fd_tbl_find(ctx, fd))) {
+		q = &ev_fd->noti_q;
+	} else {
+		return NULL;
+	}
 
-	TAILQ_FOREACH(ev_noti, &ev_fd->noti_q, qent) {
+	TAILQ_FOREACH(ev_noti, q, qent) {
 		if (ev_noti->cb == cb) return (void*)ev_noti;
 	}
 	return NULL;
@@ -64,243 +296,817 @@ void* aloe_ev_get(void *_ctx, int fd, aloe_ev_noti_cb_t cb) {
 void* aloe_ev_put(void *_ctx, int fd, aloe_ev_noti_cb_t cb, void *cbarg,
 		unsigned ev_wait, unsigned long sec, unsigned long usec) {
 	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)_ctx;
-	aloe_ev_ctx_fd_t *ev_fd;
+	aloe_ev_ctx_fd_t *ev_fd = NULL;
 	aloe_ev_ctx_noti_t *ev_noti;
-	struct timespec due;
+	struct timespec due, intv;
 	struct {
 		unsigned ev_fd_inq: 1;
-		unsigned ev_noti_inq: 1;
+		unsigned ev_fd_stale: 1;
 	} flag = {0};
 
 	if (sec == ALOE_EV_INFINITE) {
 		due.tv_sec = ALOE_EV_INFINITE;
+		intv.tv_sec = ALOE_EV_INFINITE;
 	} else {
-		if ((clock_gettime(CLOCK_MONOTONIC, &due)) != 0) {
-			int r = errno;
-			log_e("monotonic timestamp: %s(%d)\n", strerror(r), r);
+		intv.tv_sec = sec; intv.tv_nsec = usec * 1000ul;
+		ALOE_TIMESEC_NORM(intv.tv_sec, intv.tv_nsec, 1000000000ul);
+		if (now_get(ctx, &due) != 0) return NULL;
+		ALOE_TIMESEC_ADD(due.tv_sec, due.tv_nsec, intv.tv_sec, intv.tv_nsec,
+		        due.tv_sec, due.tv_nsec, 1000000000ul);
+		if (tmr_reserve(ctx) != 0) {
+			log_e("malloc timer\n");
 			return NULL;
 		}
-		ALOE_TIMESEC_ADD(due.tv_sec, due.tv_nsec, sec, usec * 1000ul,
-		        due.tv_sec, due.tv_nsec, 1000000000ul);
 	}
 
-	if ((ev_fd = fd_q_find(&ctx->fd_q, fd, 0))) {
+	// timer go without FD
+	if (fd == -1) {
+		;
+	} else if (fd < 0) {
+		log_e("invalid fd %d\n", fd);
+		return NULL;
+	} else if ((ev_fd = fd_tbl_find(ctx, fd))) {
 		flag.ev_fd_inq = 1;
-	} else if (!(ev_fd = fd_q_find(&ctx->spare_fd_q, -1, 1)) && !(ev_fd =
-	        malloc(sizeof(*ev_fd)))) {
+
+		// release pending, the FD might closed and the number reused
+		if (TAILQ_EMPTY(&ev_fd->noti_q)) flag.ev_fd_stale = 1;
+	} else if (fd_tbl_reserve(ctx, fd) != 0) {
+		log_e("malloc fd table\n");
+		return NULL;
+	} else if (!(ev_fd = aloe_ev_pool_get(&ctx->fd_pool))) {
 		log_e("malloc ev_fd\n");
 		return NULL;
 	}
 
-	if ((ev_noti = noti_q_find(&ctx->spare_noti_q, NULL, 1))) {
-		flag.ev_noti_inq = 1;
-	} else if (!(ev_noti = malloc(sizeof(*ev_noti)))) {
+	if (!(ev_noti = aloe_ev_pool_get(&ctx->noti_pool))) {
 		log_e("malloc ev_noti\n");
-		if (!flag.ev_fd_inq) {
-			TAILQ_INSERT_TAIL(&ctx->spare_fd_q, ev_fd, qent);
-		}
+		if (ev_fd && !flag.ev_fd_inq) aloe_ev_pool_put(&ctx->fd_pool, ev_fd);
 		return NULL;
 	}
+	ev_noti->state = aloe_ev_noti_state_none;
 
-	if (!flag.ev_fd_inq) {
+	if (ev_fd && !flag.ev_fd_inq) {
 		TAILQ_INIT(&ev_fd->noti_q);
-		TAILQ_INSERT_TAIL(&ctx->fd_q, ev_fd, qent);
 		ev_fd->fd = fd;
+		ev_fd->ev_reg = 0;
+		ev_fd->noti_rdy = 0;
+		ev_fd->flag.chg = ev_fd->flag.chg_defer = 0;
 	}
-	TAILQ_INSERT_TAIL(&ev_fd->noti_q, ev_noti, qent);
+
+	// backend take care of the FD when more event to wait, or register again
+	// the stale that backend might dropped
+	if (ev_fd && (ev_wait & ALOE_EV_FLAG_IO) && (flag.ev_fd_stale
+			|| (ev_wait & ALOE_EV_FLAG_BACKEND & ~ev_fd->ev_reg))) {
+		unsigned ev_reg = (flag.ev_fd_stale ? 0 : ev_fd->ev_reg)
+				| (ev_wait & ALOE_EV_FLAG_BACKEND);
+		int r;
+
+		if ((r = (*ctx->backend->ctl)(ctx, ev_fd, ev_reg)) != 0) {
+			log_e("%s monitor fd %d: %s(%d)\n", ctx->backend->name, fd,
+					strerror(r), r);
+			if (!flag.ev_fd_inq) aloe_ev_pool_put(&ctx->fd_pool, ev_fd);
+			noti_link(ctx, ev_noti, aloe_ev_noti_state_spare);
+			return NULL;
+		}
+		ev_fd->ev_reg = ev_reg;
+	}
+
+	if (ev_fd && !flag.ev_fd_inq) {
+		TAILQ_INSERT_TAIL(&ctx->fd_q, ev_fd, qent);
+		ctx->fd_tbl[fd] = ev_fd;
+		ctx->fd_cnt++;
+	}
+	ev_noti->ev_fd = ev_fd;
+	noti_link(ctx, ev_noti, (ev_fd ? aloe_ev_noti_state_fd :
+			aloe_ev_noti_state_tmr));
 	ev_noti->fd = fd;
 	ev_noti->cb = cb;
 	ev_noti->cbarg = cbarg;
 	ev_noti->ev_wait = ev_wait;
 	ev_noti->due = due;
+	ev_noti->intv = intv;
+	ev_noti->tmr_idx = -1;
+	ev_noti->prio = aloe_ev_prio_normal;
+	ev_noti->flag.periodic = ev_noti->flag.skip = 0;
+	if (due.tv_sec != ALOE_EV_INFINITE) tmr_add(ctx, ev_noti);
 	return (void*)ev_noti;
 }
 
+void* aloe_ev_put_periodic(void *_ctx, aloe_ev_noti_cb_t cb, void *cbarg,
+		unsigned long sec, unsigned long usec, aloe_ev_periodic_t policy) {
+	aloe_ev_ctx_noti_t *ev_noti;
+
+	if (sec == ALOE_EV_INFINITE || (sec == 0 && usec == 0)) {
+		log_e("invalid period\n");
+		return NULL;
+	}
+	if (!(ev_noti = (aloe_ev_ctx_noti_t*)aloe_ev_put(_ctx, -1, cb, cbarg,
+			aloe_ev_flag_persist, sec, usec))) {
+		return NULL;
+	}
+	ev_noti->flag.periodic = 1;
+	ev_noti->flag.skip = (policy == aloe_ev_periodic_skip);
+	return (void*)ev_noti;
+}
+
+/** Notify without FD and timeout to link in state. */
+static void* noti_put_state(aloe_ev_ctx_t *ctx, aloe_ev_noti_cb_t cb,
+		void *cbarg, aloe_ev_noti_state_t state) {
+	aloe_ev_ctx_noti_t *ev_noti;
+
+	if (!(ev_noti = aloe_ev_pool_get(&ctx->noti_pool))) {
+		log_e("malloc ev_noti\n");
+		return NULL;
+	}
+	ev_noti->fd = -1;
+	ev_noti->ev_fd = NULL;
+	ev_noti->cb = cb;
+	ev_noti->cbarg = cbarg;
+	ev_noti->ev_wait = 0;
+	ev_noti->due.tv_sec = ALOE_EV_INFINITE;
+	ev_noti->intv.tv_sec = ALOE_EV_INFINITE;
+	ev_noti->ev_noti = 0;
+	ev_noti->tmr_idx = -1;
+	ev_noti->prio = aloe_ev_prio_normal;
+	ev_noti->flag.periodic = ev_noti->flag.skip = 0;
+	noti_link(ctx, ev_noti, state);
+	return (void*)ev_noti;
+}
+
+void* aloe_ev_defer(void *_ctx, aloe_ev_noti_cb_t cb, void *cbarg) {
+	return noti_put_state((aloe_ev_ctx_t*)_ctx, cb, cbarg,
+			aloe_ev_noti_state_defer);
+}
+
+void* aloe_ev_idle(void *_ctx, aloe_ev_noti_cb_t cb, void *cbarg) {
+	return noti_put_state((aloe_ev_ctx_t*)_ctx, cb, cbarg,
+			aloe_ev_noti_state_idle);
+}
+
+/** Advance periodic due on the grid. */
+static int noti_rearm_periodic(aloe_ev_ctx_t *ctx,
+		aloe_ev_ctx_noti_t *ev_noti) {
+	struct timespec ts;
+	unsigned long lag, intv;
+	int r;
+
+	ALOE_TIMESEC_ADD(ev_noti->due.tv_sec, ev_noti->due.tv_nsec,
+			ev_noti->intv.tv_sec, ev_noti->intv.tv_nsec,
+			ev_noti->due.tv_sec, ev_noti->due.tv_nsec, 1000000000ul);
+	if (!ev_noti->flag.skip) return 0;
+
+	// callback just returned might take long since loop time, keep the loop
+	// time for the rest callbacks
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+		r = errno;
+		log_e("Failed to get time: %s(%d)\n", strerror(r), r);
+		return r;
+	}
+	if (ALOE_TIMESEC_CMP(ts.tv_sec, ts.tv_nsec, ev_noti->due.tv_sec,
+			ev_noti->due.tv_nsec) < 0) {
+		return 0;
+	}
+
+	// the tick after now
+	ALOE_TIMESEC_SUB(ts.tv_sec, ts.tv_nsec, ev_noti->due.tv_sec,
+			ev_noti->due.tv_nsec, ts.tv_sec, ts.tv_nsec, 1000000000ul);
+	lag = ts.tv_sec * 1000000000ul + ts.tv_nsec;
+	intv = ev_noti->intv.tv_sec * 1000000000ul + ev_noti->intv.tv_nsec;
+	lag = (lag / intv + 1) * intv;
+	ALOE_TIMESEC_ADD(ev_noti->due.tv_sec, ev_noti->due.tv_nsec,
+			lag / 1000000000ul, lag % 1000000000ul,
+			ev_noti->due.tv_sec, ev_noti->due.tv_nsec, 1000000000ul);
+	return 0;
+}
+
+/** Wait again for persistent notify after callback. */
+static void noti_rearm(aloe_ev_ctx_t *ctx, aloe_ev_ctx_noti_t *ev_noti) {
+	// FD record retained until next wait
+	noti_link(ctx, ev_noti, (ev_noti->ev_fd ? aloe_ev_noti_state_fd :
+			aloe_ev_noti_state_tmr));
+
+	if (ev_noti->intv.tv_sec == ALOE_EV_INFINITE) return;
+	if (ev_noti->flag.periodic) {
+		if (tmr_reserve(ctx) != 0 || noti_rearm_periodic(ctx, ev_noti) != 0) {
+			log_e("Failed rearm periodic\n");
+			ev_noti->due.tv_sec = ALOE_EV_INFINITE;
+			return;
+		}
+		tmr_add(ctx, ev_noti);
+		return;
+	}
+	if (tmr_reserve(ctx) != 0 || now_get(ctx, &ev_noti->due) != 0) {
+		log_e("Failed rearm timeout\n");
+		ev_noti->due.tv_sec = ALOE_EV_INFINITE;
+		return;
+	}
+	ALOE_TIMESEC_ADD(ev_noti->due.tv_sec, ev_noti->due.tv_nsec,
+			ev_noti->intv.tv_sec, ev_noti->intv.tv_nsec,
+			ev_noti->due.tv_sec, ev_noti->due.tv_nsec, 1000000000ul);
+	tmr_add(ctx, ev_noti);
+}
+
 void aloe_ev_cancel(void *_ctx, void *ev) {
 	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)_ctx;
 	aloe_ev_ctx_noti_t *ev_noti = (aloe_ev_ctx_noti_t*)ev;
-	aloe_ev_ctx_fd_t *ev_fd;
 
-	if ((ev_fd = fd_q_find(&ctx->fd_q, ev_noti->fd, 0))
-	        && noti_q_find(&ev_fd->noti_q, ev_noti, 1)) {
-		TAILQ_INSERT_TAIL(&ctx->spare_noti_q, ev_noti, qent);
-		if (TAILQ_EMPTY(&ev_fd->noti_q)) {
-			TAILQ_REMOVE(&ctx->fd_q, ev_fd, qent);
-			TAILQ_INSERT_TAIL(&ctx->spare_fd_q, ev_fd, qent);
-		}
+	switch (ev_noti->state) {
+	case aloe_ev_noti_state_spare:
+	case aloe_ev_noti_state_none:
+		// already released or release after callback
+		return;
+	case aloe_ev_noti_state_run:
+		ev_noti->state = aloe_ev_noti_state_none;
 		return;
+	default:
+		break;
+	}
+	noti_unlink(ctx, ev_noti);
+	noti_link(ctx, ev_noti, aloe_ev_noti_state_spare);
+}
+
+int aloe_ev_prio(void *_ctx, void *ev, aloe_ev_prio_t prio) {
+	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)_ctx;
+	aloe_ev_ctx_noti_t *ev_noti = (aloe_ev_ctx_noti_t*)ev;
+
+	if ((int)prio < 0 || prio >= ALOE_EV_PRIO_CNT) return EINVAL;
+	if (ev_noti->state != aloe_ev_noti_state_ready) {
+		ev_noti->prio = prio;
+		return 0;
 	}
+	TAILQ_REMOVE(&ctx->noti_q[ev_noti->prio], ev_noti, qent);
+	ev_noti->prio = prio;
+	TAILQ_INSERT_TAIL(&ctx->noti_q[ev_noti->prio], ev_noti, qent);
+	return 0;
+}
+
+void aloe_ev_fd_ready(aloe_ev_ctx_t *ctx, aloe_ev_ctx_fd_t *ev_fd,
+		unsigned triggered) {
+	aloe_ev_ctx_noti_t *ev_noti, *ev_noti_safe;
+
+	TAILQ_FOREACH_SAFE(ev_noti, &ev_fd->noti_q, qent, ev_noti_safe) {
+		if (!(ev_noti->ev_noti = triggered & ev_noti->ev_wait)) continue;
+		noti_unlink(ctx, ev_noti);
+		noti_link(ctx, ev_noti, aloe_ev_noti_state_ready);
+	}
+}
+
+/** Count overshoot of timeout. */
+static void tmr_stat_add(aloe_ev_ctx_t *ctx, const struct timespec *due,
+		const struct timespec *ts) {
+	aloe_ev_tmr_stat_t *stat = &ctx->tmr_stat;
+	unsigned long ns, lmt;
+	int i;
 
-	if (noti_q_find(&ctx->noti_q, ev_noti, 1)) {
-		TAILQ_INSERT_TAIL(&ctx->spare_noti_q, ev_noti, qent);
+	ns = (ts->tv_sec - due->tv_sec) * 1000000000ul + ts->tv_nsec - due->tv_nsec;
+	stat->cnt++;
+	stat->sum += ns;
+	if (ns > stat->max) stat->max = ns;
+	for (i = 0, lmt = 1000ul; i < (int)aloe_arraysize(stat->hist) - 1;
+			i++, lmt *= 10) {
+		if (ns < lmt) break;
+	}
+	stat->hist[i]++;
+}
+
+void aloe_ev_tmr_stat(void *_ctx, aloe_ev_tmr_stat_t *stat, int reset) {
+	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)_ctx;
+
+	if (stat) *stat = ctx->tmr_stat;
+	if (reset) memset(&ctx->tmr_stat, 0, sizeof(ctx->tmr_stat));
+}
+
+/** Callback to user, timing when profiling. */
+static void noti_cb(aloe_ev_ctx_t *ctx, aloe_ev_noti_cb_t cb, int fd,
+		unsigned triggered, void *cbarg) {
+	aloe_ev_prof_ts_t ts;
+
+	ALOE_EV_TRACE(aloe_ev_trace_cb, (const void*)cb, fd);
+	if (!ctx->prof) {
+		(*cb)(fd, triggered, cbarg);
+	} else {
+		aloe_ev_prof_enter(ctx, &ts);
+		(*cb)(fd, triggered, cbarg);
+		aloe_ev_prof_leave(ctx, cb, &ts);
+	}
+	ALOE_EV_TRACE(aloe_ev_trace_cb_end, (const void*)cb, fd);
+}
+
+/** Callback to user and release or rearm. */
+static void noti_dispatch(aloe_ev_ctx_t *ctx, aloe_ev_ctx_noti_t *ev_noti) {
+	int fd = ev_noti->fd;
+	aloe_ev_noti_cb_t cb = ev_noti->cb;
+	void *cbarg = ev_noti->cbarg;
+	unsigned triggered = ev_noti->ev_noti;
+
+	noti_unlink(ctx, ev_noti);
+	if (!(ev_noti->ev_wait & aloe_ev_flag_persist)) {
+		noti_link(ctx, ev_noti, aloe_ev_noti_state_spare);
+		noti_cb(ctx, cb, fd, triggered, cbarg);
 		return;
 	}
+	ev_noti->state = aloe_ev_noti_state_run;
+	noti_cb(ctx, cb, fd, triggered, cbarg);
+	if (ev_noti->state != aloe_ev_noti_state_run) {
+		// cancelled in callback
+		noti_link(ctx, ev_noti, aloe_ev_noti_state_spare);
+		return;
+	}
+	noti_rearm(ctx, ev_noti);
+}
+
+/** Any notify left from the previous loop. */
+static int noti_pending(aloe_ev_ctx_t *ctx) {
+	int prio;
+
+	for (prio = 0; prio < ALOE_EV_PRIO_CNT; prio++) {
+		if (!TAILQ_EMPTY(&ctx->noti_q[prio])) return 1;
+	}
+	return 0;
+}
+
+/** Budget for the loop used up. */
+static int budget_over(aloe_ev_ctx_t *ctx, int cnt,
+		const struct timespec *start) {
+	struct timespec ts;
+
+	if (ctx->budget_cb > 0 && (unsigned long)cnt >= ctx->budget_cb) return 1;
+	if (ctx->budget_ns == 0 || clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+		return 0;
+	}
+	ALOE_TIMESEC_SUB(ts.tv_sec, ts.tv_nsec, start->tv_sec, start->tv_nsec,
+			ts.tv_sec, ts.tv_nsec, 1000000000ul);
+	return (unsigned long)ts.tv_sec * 1000000000ul + ts.tv_nsec
+			>= ctx->budget_ns;
+}
+
+/** Average interval to IO, 1/8 weight for new sample. */
+#define ALOE_EV_SPIN_EWMA_SHIFT 3
+
+/** IO ready, revise time to spin from interval to last IO. */
+static void spin_adapt(aloe_ev_ctx_t *ctx) {
+	aloe_ev_spin_stat_t *stat = &ctx->spin_stat;
+	struct timespec ts;
+	unsigned long gap;
+
+	ALOE_TIMESEC_SUB(ctx->now.tv_sec, ctx->now.tv_nsec, ctx->spin_last.tv_sec,
+			ctx->spin_last.tv_nsec, ts.tv_sec, ts.tv_nsec, 1000000000ul);
+	ctx->spin_last = ctx->now;
+	gap = (ts.tv_sec > 1 ? 1000000000ul :
+			(unsigned long)ts.tv_sec * 1000000000ul + ts.tv_nsec);
+	stat->gap_ns = stat->gap_ns - (stat->gap_ns >> ALOE_EV_SPIN_EWMA_SHIFT)
+			+ (gap >> ALOE_EV_SPIN_EWMA_SHIFT);
+
+	// IO likely come within twice the interval
+	if (stat->gap_ns > ctx->spin_max) {
+		stat->budget_ns = 0;
+	} else if ((stat->budget_ns = stat->gap_ns * 2) > ctx->spin_max) {
+		stat->budget_ns = ctx->spin_max;
+	}
+}
+
+/** Poll IO without sleep up to time to spin, 0 or errno. */
+static int spin_wait(aloe_ev_ctx_t *ctx, struct timespec *tmo, int *hit) {
+	aloe_ev_spin_stat_t *stat = &ctx->spin_stat;
+	struct timespec zero = {0}, start, ts;
+	unsigned long lmt = stat->budget_ns, ns;
+	int r;
+
+	if (tmo && (unsigned long)tmo->tv_sec * 1000000000ul + tmo->tv_nsec < lmt) {
+		lmt = tmo->tv_sec * 1000000000ul + tmo->tv_nsec;
+	}
+	if ((r = aloe_ev_now_update(ctx)) != 0) return r;
+	start = ctx->now;
+	stat->spin++;
+	do {
+		if ((r = (*ctx->backend->wait)(ctx, &zero)) != 0) return r;
+		if ((r = aloe_ev_now_update(ctx)) != 0) return r;
+		ALOE_TIMESEC_SUB(ctx->now.tv_sec, ctx->now.tv_nsec, start.tv_sec,
+				start.tv_nsec, ts.tv_sec, ts.tv_nsec, 1000000000ul);
+		ns = ts.tv_sec * 1000000000ul + ts.tv_nsec;
+		if ((*hit = noti_pending(ctx))) {
+			stat->hit++;
+			break;
+		}
+	} while (ns < lmt);
+	stat->ns += ns;
+
+	// spin less until IO come again
+	if (!*hit) stat->budget_ns >>= 1;
+
+	// the rest to sleep
+	if (tmo) {
+		if (ALOE_TIMESEC_CMP(tmo->tv_sec, tmo->tv_nsec,
+				ts.tv_sec, ts.tv_nsec) > 0) {
+			ALOE_TIMESEC_SUB(tmo->tv_sec, tmo->tv_nsec, ts.tv_sec, ts.tv_nsec,
+					tmo->tv_sec, tmo->tv_nsec, 1000000000ul);
+		} else {
+			tmo->tv_sec = 0; tmo->tv_nsec = 0;
+		}
+	}
+	return 0;
+}
+
+void aloe_ev_spin_stat(void *_ctx, aloe_ev_spin_stat_t *stat, int reset) {
+	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)_ctx;
+
+	if (stat) *stat = ctx->spin_stat;
+	if (reset) {
+		ctx->spin_stat.spin = ctx->spin_stat.hit = ctx->spin_stat.ns = 0;
+	}
 }
 
 int aloe_ev_once(void *_ctx) {
 	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)_ctx;
-	int r, fdmax = -1;
-	fd_set rdset, wrset, exset;
-	aloe_ev_ctx_noti_t *ev_noti, *ev_noti_safe;
-	aloe_ev_ctx_fd_t *ev_fd, *ev_fd_safe;
-	struct timeval sel_tmr = {.tv_sec = ALOE_EV_INFINITE};
-	struct timespec ts, *due = NULL;
+	int r, fdmax, prio, pend, hit = 0;
+	aloe_ev_ctx_noti_t *ev_noti;
+	struct timespec ts, *due = NULL, tmo = {.tv_sec = ALOE_EV_INFINITE};
 
-	FD_ZERO(&rdset); FD_ZERO(&wrset); FD_ZERO(&exset);
+	fd_chg_flush(ctx);
+#ifdef WITH_IO_URING
+	// submit in batch
+	if (ctx->uring) aloe_ev_uring_flush(ctx);
+#endif
 
-	TAILQ_FOREACH(ev_fd, &ctx->fd_q, qent) {
-		if (ev_fd->fd != -1 && ev_fd->fd > fdmax) fdmax = ev_fd->fd;
-		TAILQ_FOREACH(ev_noti, &ev_fd->noti_q, qent) {
-			if (ev_fd->fd != -1) {
-				if (ev_noti->ev_wait & aloe_ev_flag_read) {
-					FD_SET(ev_fd->fd, &rdset);
-				}
-				if (ev_noti->ev_wait & aloe_ev_flag_write) {
-					FD_SET(ev_fd->fd, &wrset);
-				}
-				if (ev_noti->ev_wait & aloe_ev_flag_except) {
-					FD_SET(ev_fd->fd, &exset);
-				}
-			}
-			if (ev_noti->due.tv_sec != ALOE_EV_INFINITE && (!due
-					|| ALOE_TIMESEC_CMP(ev_noti->due.tv_sec, ev_noti->due.tv_nsec,
-							due->tv_sec, due->tv_nsec) < 0)) {
-				due = &ev_noti->due;
-			}
-		}
+	// deferred since last loop
+	while ((ev_noti = TAILQ_FIRST(&ctx->defer_q))) {
+		noti_unlink(ctx, ev_noti);
+		noti_link(ctx, ev_noti, aloe_ev_noti_state_ready);
 	}
 
-	// convert due for select()
-	if (due) {
-		if ((clock_gettime(CLOCK_MONOTONIC, &ts)) != 0) {
-			r = errno;
-			log_e("Failed to get time: %s(%d)\n", strerror(r), r);
-			return r;
-		}
+	if (ctx->tmr_cnt > 0) due = &ctx->tmr[0]->due;
+
+	// convert due for backend
+	if ((pend = (noti_pending(ctx) || !TAILQ_EMPTY(&ctx->idle_q)))) {
+		// deferred, over budget last loop, or idle callback, poll only
+		tmo.tv_sec = 0; tmo.tv_nsec = 0;
+	} else if (due) {
+		// callbacks of last loop took time since loop time
+		if ((r = aloe_ev_now_update(ctx)) != 0) return r;
+		ts = ctx->now;
 		if (ALOE_TIMESEC_CMP(ts.tv_sec, ts.tv_nsec,
 				due->tv_sec, due->tv_nsec) < 0) {
 			ALOE_TIMESEC_SUB(due->tv_sec, due->tv_nsec,
-					ts.tv_sec, ts.tv_nsec, ts.tv_sec, ts.tv_nsec, 1000000000ul);
-			sel_tmr.tv_sec = ts.tv_sec; sel_tmr.tv_usec = ts.tv_nsec / 1000ul;
+					ts.tv_sec, ts.tv_nsec, tmo.tv_sec, tmo.tv_nsec, 1000000000ul);
 		} else {
-			sel_tmr.tv_sec = 0; sel_tmr.tv_usec = 0;
+			tmo.tv_sec = 0; tmo.tv_nsec = 0;
 		}
-	} else if (fdmax == -1) {
-		// infinite waiting
-		sel_tmr.tv_sec = 0; sel_tmr.tv_usec = 0;
+	} else if (ctx->fd_cnt <= ctx->fd_sys && TAILQ_EMPTY(&ctx->io_q)) {
+		// infinite waiting, not count internal wakeup
+		tmo.tv_sec = 0; tmo.tv_nsec = 0;
 	}
 
 #if ALOE_EV_PREVENT_BUSY_WAITING
-	if (sel_tmr.tv_sec == 0 && sel_tmr.tv_usec < ALOE_EV_PREVENT_BUSY_WAITING) {
-		sel_tmr.tv_usec = ALOE_EV_PREVENT_BUSY_WAITING;
+	if (!ctx->flag.hires && !pend && tmo.tv_sec == 0
+			&& tmo.tv_nsec < ALOE_EV_PREVENT_BUSY_WAITING * 1000ul) {
+		tmo.tv_nsec = ALOE_EV_PREVENT_BUSY_WAITING * 1000ul;
 	}
 #endif
 
-	if ((fdmax = select(fdmax + 1, &rdset, &wrset, &exset,
-			(sel_tmr.tv_sec == ALOE_EV_INFINITE ? NULL : &sel_tmr))) < 0) {
-		r = errno;
-//		if (r == EINTR) {
-//			log_d("Interrupted when wait IO: %s(%d)\n", strerror(r), r);
-//		} else {
-			log_e("Failed to wait IO: %s(%d)\n", strerror(r), r);
-//		}
+	// spin before sleep
+	if (ctx->spin_stat.budget_ns > 0 && (tmo.tv_sec != 0 || tmo.tv_nsec > 0)
+			&& (r = spin_wait(ctx, (tmo.tv_sec == ALOE_EV_INFINITE ? NULL :
+			&tmo), &hit)) != 0) {
 		return r;
 	}
 
-	if ((r = clock_gettime(CLOCK_MONOTONIC, &ts)) != 0) {
-		r = errno;
-		log_e("Failed to get time: %s(%d)\n", strerror(r), r);
-		return r;
+	if (!hit) {
+		ALOE_EV_TRACE(aloe_ev_trace_wait, NULL, (tmo.tv_sec == ALOE_EV_INFINITE
+				? -1l : tmo.tv_sec * 1000000l + tmo.tv_nsec / 1000l));
+		r = (*ctx->backend->wait)(ctx,
+				(tmo.tv_sec == ALOE_EV_INFINITE ? NULL : &tmo));
+		ALOE_EV_TRACE(aloe_ev_trace_wakeup, NULL, r);
+		if (r != 0) return r;
 	}
 
-	TAILQ_FOREACH_SAFE(ev_fd, &ctx->fd_q, qent, ev_fd_safe) {
-		unsigned triggered = 0;
+	if ((r = aloe_ev_now_update(ctx)) != 0) return r;
+	ts = ctx->now;
+	if (ctx->spin_max > 0 && !pend && noti_pending(ctx)) spin_adapt(ctx);
 
-		if (fdmax > 0 && ev_fd->fd != -1) {
-			if (FD_ISSET(ev_fd->fd, &rdset)) {
-				triggered |= aloe_ev_flag_read;
-				fdmax--;
-			}
-			if (FD_ISSET(ev_fd->fd, &wrset)) {
-				triggered |= aloe_ev_flag_write;
-				fdmax--;
-			}
-			if (FD_ISSET(ev_fd->fd, &exset)) {
-				triggered |= aloe_ev_flag_except;
-				fdmax--;
-			}
+	// expired in order of due
+	while (ctx->tmr_cnt > 0 && ALOE_TIMESEC_CMP(ctx->tmr[0]->due.tv_sec,
+			ctx->tmr[0]->due.tv_nsec, ts.tv_sec, ts.tv_nsec) <= 0) {
+		ev_noti = ctx->tmr[0];
+		tmr_stat_add(ctx, &ev_noti->due, &ts);
+		ALOE_EV_TRACE(aloe_ev_trace_tmr, (const void*)ev_noti->cb, 0);
+		ev_noti->ev_noti = aloe_ev_flag_time;
+		noti_unlink(ctx, ev_noti);
+		noti_link(ctx, ev_noti, aloe_ev_noti_state_ready);
+	}
+
+	fdmax = 0;
+	for (prio = 0; prio < ALOE_EV_PRIO_CNT; prio++) {
+		while ((ev_noti = TAILQ_FIRST(&ctx->noti_q[prio]))) {
+			// the rest deferred to next loop
+			if (prio != aloe_ev_prio_rt && budget_over(ctx, fdmax, &ts)) break;
+			fdmax++;
+			noti_dispatch(ctx, ev_noti);
 		}
-		TAILQ_FOREACH_SAFE(ev_noti, &ev_fd->noti_q, qent, ev_noti_safe) {
-			if (!(ev_noti->ev_noti = triggered & ev_noti->ev_wait)
-					&& ev_noti->due.tv_sec != ALOE_EV_INFINITE
-					&& ALOE_TIMESEC_CMP(ev_noti->due.tv_sec, ev_noti->due.tv_nsec,
-							ts.tv_sec, ts.tv_nsec) <= 0) {
-				ev_noti->ev_noti |= aloe_ev_flag_time;
-			}
-			if (ev_noti->ev_noti) {
-				TAILQ_REMOVE(&ev_fd->noti_q, ev_noti, qent);
-				TAILQ_INSERT_TAIL(&ctx->noti_q, ev_noti, qent);
-			}
+	}
+
+	// idle callback queued before, not those put by idle callback
+	if (fdmax == 0 && !TAILQ_EMPTY(&ctx->idle_q)) {
+		int cnt = 0;
+
+		TAILQ_FOREACH(ev_noti, &ctx->idle_q, qent) cnt++;
+		while (cnt-- > 0 && (ev_noti = TAILQ_FIRST(&ctx->idle_q))) {
+			fdmax++;
+			noti_dispatch(ctx, ev_noti);
 		}
-		if (TAILQ_EMPTY(&ev_fd->noti_q)) {
-			TAILQ_REMOVE(&ctx->fd_q, ev_fd, qent);
-			TAILQ_INSERT_TAIL(&ctx->spare_fd_q, ev_fd, qent);
+	}
+	return 0;
+}
+
+/** Index plus 1 in the slab, 0 for record from malloc. */
+static unsigned post_slab_idx(aloe_ev_ctx_t *ctx, aloe_ev_ctx_post_t *post) {
+	unsigned long off = (unsigned long)post - (unsigned long)ctx->post_slab;
+
+	if (!ctx->post_slab
+			|| off >= sizeof(*post) * ALOE_EV_POST_SLAB) {
+		return 0;
+	}
+	return (unsigned)(off / sizeof(*post)) + 1;
+}
+
+/** Pop spare from any thread, generation changed every push and pop. */
+static aloe_ev_ctx_post_t* post_spare_pop(aloe_ev_ctx_t *ctx) {
+	uint64_t spare = __atomic_load_n(&ctx->post_spare, __ATOMIC_ACQUIRE), val;
+	unsigned idx;
+
+	while ((idx = (unsigned)spare) != 0) {
+		// stale when other popped, then the generation fail the exchange
+		val = (((spare >> 32) + 1) << 32) | __atomic_load_n(
+				&ctx->post_slab[idx - 1].spare_next, __ATOMIC_RELAXED);
+		if (__atomic_compare_exchange_n(&ctx->post_spare, &spare, val, 1,
+				__ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+			return &ctx->post_slab[idx - 1];
 		}
 	}
+	return NULL;
+}
+
+/** Push chain of spare linked from first to last, by the loop. */
+static void post_spare_push(aloe_ev_ctx_t *ctx, unsigned first,
+		aloe_ev_ctx_post_t *last) {
+	uint64_t spare = __atomic_load_n(&ctx->post_spare, __ATOMIC_RELAXED), val;
+
+	do {
+		__atomic_store_n(&last->spare_next, (unsigned)spare, __ATOMIC_RELAXED);
+		val = (((spare >> 32) + 1) << 32) | first;
+	} while (!__atomic_compare_exchange_n(&ctx->post_spare, &spare, val, 1,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+int aloe_ev_post(void *_ctx, aloe_ev_post_cb_t cb, void *cbarg) {
+	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)_ctx;
+	aloe_ev_ctx_post_t *post, *head;
+	uint64_t val = 1;
+	int r;
+
+	if (!(post = post_spare_pop(ctx)) && !(post = malloc(sizeof(*post)))) {
+		log_e("malloc post\n");
+		return ENOMEM;
+	}
+	post->cb = cb;
+	post->cbarg = cbarg;
+	head = __atomic_load_n(&ctx->post, __ATOMIC_RELAXED);
+	do {
+		post->next = head;
+	} while (!__atomic_compare_exchange_n(&ctx->post, &head, post, 1,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED));
 
-	fdmax = 0;
-	while ((ev_noti = TAILQ_FIRST(&ctx->noti_q))) {
-		int fd = ev_noti->fd;
-		aloe_ev_noti_cb_t cb = ev_noti->cb;
-		void *cbarg = ev_noti->cbarg;
-		unsigned triggered = ev_noti->ev_noti;
-
-		fdmax++;
-		TAILQ_REMOVE(&ctx->noti_q, ev_noti, qent);
-		TAILQ_INSERT_TAIL(&ctx->spare_noti_q, ev_noti, qent);
-		(*cb)(fd, triggered, cbarg);
+	// loop wakeup already pending for the previous task
+	if (head) return 0;
+
+	while (write(ctx->post_fd[1], &val, sizeof(val)) < 0) {
+		r = errno;
+		if (r == EINTR) continue;
+		// pipe full that loop wakeup anyway
+		if (ALOE_ENO_NONBLOCKING(r)) break;
+		log_e("Failed wakeup loop: %s(%d)\n", strerror(r), r);
+		return r;
 	}
-	return fdmax;
+	return 0;
 }
 
-void* aloe_ev_init(void) {
+/** Run task posted in order. */
+static void post_on_read(int fd, unsigned ev_noti, void *cbarg) {
+	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)cbarg;
+	aloe_ev_ctx_post_t *post, *next, *todo = NULL, *last = NULL;
+	uint64_t val[8];
+	unsigned idx, first = 0;
+
+	// clear wakeup before take the tasks that later post wakeup again
+	while (read(fd, val, sizeof(val)) > 0);
+
+	post = __atomic_exchange_n(&ctx->post, NULL, __ATOMIC_ACQUIRE);
+	for ( ; post; post = next) {
+		next = post->next;
+		post->next = todo;
+		todo = post;
+	}
+	for ( ; todo; todo = next) {
+		next = todo->next;
+		(*todo->cb)(todo->cbarg);
+		if (!(idx = post_slab_idx(ctx, todo))) {
+			free(todo);
+			continue;
+		}
+		// chain for later post
+		todo->spare_next = first;
+		first = idx;
+		if (!last) last = todo;
+	}
+	if (first) post_spare_push(ctx, first, last);
+}
+
+/** Prepare FD to wakeup for posted task. */
+static int post_init(aloe_ev_ctx_t *ctx) {
+	int r;
+
+	ctx->post_ev = NULL;
+#ifdef HAVE_SYS_EVENTFD_H
+	if ((ctx->post_fd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) != -1) {
+		ctx->post_fd[1] = ctx->post_fd[0];
+	} else
+#endif
+	if (pipe(ctx->post_fd) == 0) {
+		if ((r = aloe_file_nonblock(ctx->post_fd[0], 1)) != 0
+				|| (r = aloe_file_nonblock(ctx->post_fd[1], 1)) != 0) {
+			log_e("Failed set wakeup pipe nonblock\n");
+			goto finally;
+		}
+		fcntl(ctx->post_fd[0], F_SETFD, FD_CLOEXEC);
+		fcntl(ctx->post_fd[1], F_SETFD, FD_CLOEXEC);
+	} else {
+		r = errno;
+		ctx->post_fd[0] = ctx->post_fd[1] = -1;
+		log_e("Failed create wakeup: %s(%d)\n", strerror(r), r);
+		return r;
+	}
+	if (!(ctx->post_ev = aloe_ev_put(ctx, ctx->post_fd[0], &post_on_read, ctx,
+			aloe_ev_flag_read | aloe_ev_flag_persist, ALOE_EV_INFINITE, 0))) {
+		r = EIO;
+		log_e("Failed schedule wakeup\n");
+		goto finally;
+	}
+	ctx->fd_sys++;
+	r = 0;
+finally:
+	if (r != 0) {
+		if (ctx->post_fd[1] != ctx->post_fd[0]) close(ctx->post_fd[1]);
+		close(ctx->post_fd[0]);
+		ctx->post_fd[0] = ctx->post_fd[1] = -1;
+	}
+	return r;
+}
+
+void* aloe_ev_init2(const aloe_ev_cfg_t *cfg) {
 	aloe_ev_ctx_t *ctx;
+	const aloe_ev_backend_t **backend;
+	const char *backend_name = (cfg ? cfg->backend : NULL);
+	int i;
 
 	if (!(ctx = malloc(sizeof(*ctx)))) {
 		log_e("malloc ev ctx\n");
 		return NULL;
 	}
 	TAILQ_INIT(&ctx->fd_q);
-	TAILQ_INIT(&ctx->spare_fd_q);
-	TAILQ_INIT(&ctx->noti_q);
-	TAILQ_INIT(&ctx->spare_noti_q);
+	for (i = 0; i < ALOE_EV_PRIO_CNT; i++) TAILQ_INIT(&ctx->noti_q[i]);
+	TAILQ_INIT(&ctx->tmr_q);
+	TAILQ_INIT(&ctx->defer_q);
+	TAILQ_INIT(&ctx->idle_q);
+	ctx->fd_cnt = ctx->fd_sys = 0;
+	aloe_ev_pool_init(&ctx->fd_pool, sizeof(aloe_ev_ctx_fd_t),
+			offsetof(aloe_ev_ctx_fd_t, qent), (cfg ? cfg->pool_spare_max : 0));
+	aloe_ev_pool_init(&ctx->noti_pool, sizeof(aloe_ev_ctx_noti_t),
+			offsetof(aloe_ev_ctx_noti_t, qent), (cfg ? cfg->pool_spare_max : 0));
+	ctx->tmr = NULL;
+	ctx->tmr_cnt = ctx->tmr_cap = 0;
+	ctx->fd_tbl = NULL;
+	ctx->fd_tbl_cap = 0;
+	ctx->chg = NULL;
+	ctx->chg_cnt = ctx->chg_cap = 0;
+	ctx->backend_ctx = NULL;
+	ctx->post = NULL;
+	ctx->post_spare = 0;
+	if ((ctx->post_slab = malloc(sizeof(*ctx->post_slab)
+			* ALOE_EV_POST_SLAB))) {
+		for (i = 0; i < ALOE_EV_POST_SLAB; i++) {
+			ctx->post_slab[i].spare_next = i + 2;
+		}
+		ctx->post_slab[ALOE_EV_POST_SLAB - 1].spare_next = 0;
+		ctx->post_spare = 1;
+	}
+	ctx->wq_done = NULL;
+	ctx->post_fd[0] = ctx->post_fd[1] = -1;
+	TAILQ_INIT(&ctx->io_q);
+	ctx->uring = NULL;
+	ctx->flag.uring_chk = 0;
+	ctx->flag.hires = (cfg && cfg->hires) ? 1 : 0;
+	ctx->flag.precise = (cfg && cfg->precise) ? 1 : 0;
+	clock_gettime(CLOCK_MONOTONIC, &ctx->now);
+	ctx->spin_last = ctx->now;
+	ctx->budget_cb = (cfg ? cfg->budget_cb : 0);
+	ctx->budget_ns = (cfg ? cfg->budget_us * 1000ul : 0);
+	ctx->spin_max = (cfg ? cfg->spin_us * 1000ul : 0);
+	ctx->prof = NULL;
+	ctx->prof_slow = 0;
+	memset(&ctx->spin_stat, 0, sizeof(ctx->spin_stat));
+	ctx->spin_stat.budget_ns = ctx->spin_stat.gap_ns = ctx->spin_max;
+	memset(&ctx->tmr_stat, 0, sizeof(ctx->tmr_stat));
+#if defined(HAVE_SYS_PRCTL_H) && defined(PR_SET_TIMERSLACK)
+	if (cfg && cfg->tmr_slack > 0
+			&& prctl(PR_SET_TIMERSLACK, cfg->tmr_slack, 0, 0, 0) != 0) {
+		int r = errno;
+		log_e("Failed set timer slack: %s(%d)\n", strerror(r), r);
+	}
+#endif
+	if (cfg && cfg->io_engine && strcasecmp(cfg->io_engine, "readiness") == 0) {
+		ctx->flag.uring_chk = 1;
+	}
+
+	// first workable backend in order
+	for (backend = backend_lut; *backend; backend++) {
+		if (backend_name && backend_name[0]
+				&& strcasecmp((*backend)->name, backend_name) != 0) {
+			continue;
+		}
+		if ((*(*backend)->init)(ctx) == 0) break;
+		log_e("Failed init event backend %s\n", (*backend)->name);
+	}
+	if (!(ctx->backend = *backend)) {
+		log_e("No event backend%s%s\n", (backend_name ? " " : ""),
+				(backend_name ? backend_name : ""));
+		if (ctx->post_slab) free(ctx->post_slab);
+		free(ctx);
+		return NULL;
+	}
+	if (cfg && cfg->pool_prealloc > 0
+			&& (aloe_ev_pool_reserve(&ctx->fd_pool, cfg->pool_prealloc) != 0
+			|| aloe_ev_pool_reserve(&ctx->noti_pool, cfg->pool_prealloc) != 0)) {
+		log_e("malloc ev pool\n");
+		aloe_ev_destroy(ctx);
+		return NULL;
+	}
+	if (cfg && cfg->prof && aloe_ev_prof_init(ctx, cfg->prof_slow_us) != 0) {
+		aloe_ev_destroy(ctx);
+		return NULL;
+	}
+	if (post_init(ctx) != 0) {
+		aloe_ev_destroy(ctx);
+		return NULL;
+	}
 	return (void*)ctx;
 }
 
+void* aloe_ev_init(void) {
+	return aloe_ev_init2(NULL);
+}
+
+const char* aloe_ev_backend(void *_ctx) {
+	return ((aloe_ev_ctx_t*)_ctx)->backend->name;
+}
+
+void aloe_ev_pool_stat(void *_ctx, aloe_ev_pool_stat_t *fd,
+		aloe_ev_pool_stat_t *noti) {
+	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)_ctx;
+
+	if (fd) *fd = ctx->fd_pool.stat;
+	if (noti) *noti = ctx->noti_pool.stat;
+}
+
 void aloe_ev_destroy(void *_ctx) {
 	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)_ctx;
-	aloe_ev_ctx_noti_t *ev_noti;
-	aloe_ev_ctx_fd_t *ev_fd;
+	aloe_ev_ctx_post_t *post;
+	aloe_ev_job_t *job;
 
-	while ((ev_fd = TAILQ_FIRST(&ctx->fd_q))) {
-		TAILQ_REMOVE(&ctx->fd_q, ev_fd, qent);
-		while ((ev_noti = TAILQ_FIRST(&ev_fd->noti_q))) {
-			TAILQ_REMOVE(&ev_fd->noti_q, ev_noti, qent);
-			free(ev_noti);
-		}
-		free(ev_fd);
-	}
-	while ((ev_fd = TAILQ_FIRST(&ctx->spare_fd_q))) {
-		TAILQ_REMOVE(&ctx->fd_q, ev_fd, qent);
-		free(ev_fd);
+	aloe_ev_io_destroy(ctx);
+
+	// job done not delivered
+	while ((job = ctx->wq_done)) {
+		ctx->wq_done = job->next;
+		free(job);
 	}
-	while ((ev_noti = TAILQ_FIRST(&ctx->noti_q))) {
-		TAILQ_REMOVE(&ctx->noti_q, ev_noti, qent);
-		free(ev_noti);
+
+	// task not run yet
+	while ((post = ctx->post)) {
+		ctx->post = post->next;
+		if (!post_slab_idx(ctx, post)) free(post);
 	}
-	while ((ev_noti = TAILQ_FIRST(&ctx->spare_noti_q))) {
-		TAILQ_REMOVE(&ctx->spare_noti_q, ev_noti, qent);
-		free(ev_noti);
+	if (ctx->post_slab) free(ctx->post_slab);
+	if (ctx->post_fd[0] != -1) {
+		if (ctx->post_fd[1] != ctx->post_fd[0]) close(ctx->post_fd[1]);
+		close(ctx->post_fd[0]);
 	}
+
+	// records in queues all from the pools
+	aloe_ev_pool_destroy(&ctx->noti_pool);
+	aloe_ev_pool_destroy(&ctx->fd_pool);
+	(*ctx->backend->destroy)(ctx);
+	aloe_ev_prof_destroy(ctx);
+	if (ctx->chg) free(ctx->chg);
+	if (ctx->tmr) free(ctx->tmr);
+	if (ctx->fd_tbl) free(ctx->fd_tbl);
 	free(ctx);
 }
@@ -0,0 +1,127 @@
+/**
+ * @author joelai
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "priv.h"
+
+#include <aloe/ev_co.hpp>
+
+#include <unistd.h>
+
+static struct {
+	int fail;
+	int woke; /**< Resumed from the wait in destroyed task. */
+	int done;
+} impl;
+
+#define co_check(_c) if (!(_c)) { \
+	log_e("check failed: %s\n", #_c); \
+	impl.fail++; \
+}
+
+__attribute__((format(printf, 4, 5)))
+int log_printf(const char *lvl, const char *func_name, int lno,
+		const char *fmt, ...) {
+	int r;
+	va_list va;
+
+	if ((int)(unsigned long)lvl != log_level_err) return 0;
+	fprintf(stderr, "[%s][#%d]", func_name, lno);
+	va_start(va, fmt);
+	r = vfprintf(stderr, fmt, va);
+	va_end(va);
+	return r;
+}
+
+/** Result without default constructor. */
+struct nodef_t {
+	explicit nodef_t(int v): v(v) {}
+	int v;
+};
+
+static aloe::ev::task<nodef_t> co_nodef(int v) {
+	co_await aloe::ev::sleep_for(1);
+	co_return nodef_t(v);
+}
+
+static aloe::ev::task<> co_main(int fd) {
+	nodef_t r = co_await co_nodef(3);
+
+	co_check(r.v == 3);
+	co_check(co_await aloe::ev::readable(fd, 0, 1000) == aloe_ev_flag_time);
+	impl.done = 1;
+}
+
+static aloe::ev::task<> co_waiter(int fd) {
+	co_await aloe::ev::readable(fd);
+	impl.woke++;
+}
+
+/** Not coroutine, keep the destroyed frame in pool untouched. */
+static void on_done(int, unsigned, void*) {
+	impl.done = 1;
+}
+
+static int run(void *ctx) {
+	int r;
+
+	while (!impl.done) {
+		if ((r = aloe_ev_once(ctx)) != 0) {
+			log_e("aloe_ev_once: %s(%d)\n", strerror(r), r);
+			return r;
+		}
+	}
+	impl.done = 0;
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	void *ctx = NULL;
+	int fd[2] = {-1, -1}, r;
+
+	if (!(ctx = aloe_ev_init())) {
+		r = ENOMEM;
+		goto finally;
+	}
+	if (pipe(fd) != 0) {
+		r = errno;
+		log_e("pipe: %s(%d)\n", strerror(r), r);
+		goto finally;
+	}
+
+	aloe::ev::spawn(ctx, co_main(fd[0]));
+	if ((r = run(ctx)) != 0) goto finally;
+
+	// destroy the task waiting readable, then make it readable
+	{
+		aloe::ev::task<>::handle_t h = co_waiter(fd[0]).release();
+		void *prev = std::exchange(aloe::ev::current(), ctx);
+
+		h.resume();
+		aloe::ev::current() = prev;
+		h.destroy();
+	}
+	if (write(fd[1], "x", 1) != 1) {
+		r = errno;
+		log_e("write: %s(%d)\n", strerror(r), r);
+		goto finally;
+	}
+	if (!aloe_ev_put(ctx, -1, &on_done, NULL, 0, 0, 10000)) {
+		r = ENOMEM;
+		goto finally;
+	}
+	if ((r = run(ctx)) != 0) goto finally;
+	co_check(impl.woke == 0);
+
+	r = impl.fail ? EIO : 0;
+finally:
+	if (fd[0] != -1) close(fd[0]);
+	if (fd[1] != -1) close(fd[1]);
+	if (ctx) aloe_ev_destroy(ctx);
+	printf("%s\n", r == 0 ? "pass" : "fail");
+	return r == 0 ? 0 : 1;
+}
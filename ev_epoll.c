@@ -0,0 +1,265 @@
+/**
+ * @author joelai
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "priv.h"
+
+#include <unistd.h>
+#include <limits.h>
+#include <sys/epoll.h>
+#ifdef HAVE_SYS_TIMERFD_H
+#  include <sys/timerfd.h>
+#endif
+
+/** Initial count of events to fetch per wait. */
+#define EPOLL_EVS_MIN 64
+
+/** Maximal count of events to fetch per wait. */
+#define EPOLL_EVS_MAX 4096
+
+/** Interest set keep in kernel. */
+typedef struct {
+	int epfd;
+	struct epoll_event *evs;
+	int evs_cap;
+
+	/** FD always ready but epoll refused to monitor, ie. regular file. */
+	aloe_ev_ctx_fd_t **noep;
+	int noep_cnt, noep_cap;
+
+	/** Wakeup for timeout in nano-seconds without epoll_pwait2(). */
+	int tfd;
+	struct {
+		unsigned nopwait2: 1; /**< Kernel lack epoll_pwait2(). */
+	} flag;
+} ep_t;
+
+static int ep_init(aloe_ev_ctx_t *ctx) {
+	ep_t *ep;
+	int r;
+
+	if (!(ep = malloc(sizeof(*ep)))) {
+		log_e("malloc epoll backend\n");
+		return ENOMEM;
+	}
+	ep->noep = NULL;
+	ep->noep_cnt = ep->noep_cap = 0;
+	ep->tfd = -1;
+	ep->flag.nopwait2 = 0;
+	if (!(ep->evs = malloc(EPOLL_EVS_MIN * sizeof(*ep->evs)))) {
+		log_e("malloc epoll events\n");
+		free(ep);
+		return ENOMEM;
+	}
+	ep->evs_cap = EPOLL_EVS_MIN;
+	if ((ep->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		r = errno;
+		log_e("Failed create epoll: %s(%d)\n", strerror(r), r);
+		free(ep->evs);
+		free(ep);
+		return r;
+	}
+	ctx->backend_ctx = (void*)ep;
+	return 0;
+}
+
+static void ep_destroy(aloe_ev_ctx_t *ctx) {
+	ep_t *ep = (ep_t*)ctx->backend_ctx;
+
+	if (!ep) return;
+	close(ep->epfd);
+	if (ep->tfd != -1) close(ep->tfd);
+	free(ep->evs);
+	if (ep->noep) free(ep->noep);
+	free(ep);
+	ctx->backend_ctx = NULL;
+}
+
+static int ep_noep_find(ep_t *ep, aloe_ev_ctx_fd_t *ev_fd) {
+	int i;
+
+	for (i = 0; i < ep->noep_cnt; i++) {
+		if (ep->noep[i] == ev_fd) return i;
+	}
+	return -1;
+}
+
+static int ep_noep_add(ep_t *ep, aloe_ev_ctx_fd_t *ev_fd) {
+	if (ep->noep_cnt >= ep->noep_cap) {
+		int cap = ep->noep_cap ? ep->noep_cap * 2 : 8;
+		aloe_ev_ctx_fd_t **noep;
+
+		if (!(noep = realloc(ep->noep, cap * sizeof(*noep)))) {
+			log_e("malloc epoll regular file list\n");
+			return ENOMEM;
+		}
+		ep->noep = noep;
+		ep->noep_cap = cap;
+	}
+	ep->noep[ep->noep_cnt++] = ev_fd;
+	return 0;
+}
+
+static int ep_ctl(aloe_ev_ctx_t *ctx, aloe_ev_ctx_fd_t *ev_fd,
+		unsigned ev_wait) {
+	ep_t *ep = (ep_t*)ctx->backend_ctx;
+	struct epoll_event ev = {.data = {.ptr = ev_fd}};
+	int r, op, noep_idx;
+
+	if ((noep_idx = (ep->noep_cnt > 0 ? ep_noep_find(ep, ev_fd) : -1)) >= 0) {
+		if (!ev_wait) ep->noep[noep_idx] = ep->noep[--ep->noep_cnt];
+		return 0;
+	}
+
+	if (ev_wait & aloe_ev_flag_read) ev.events |= EPOLLIN;
+	if (ev_wait & aloe_ev_flag_write) ev.events |= EPOLLOUT;
+	if (ev_wait & aloe_ev_flag_except) ev.events |= EPOLLPRI;
+	if (ev_wait & aloe_ev_flag_edge) ev.events |= EPOLLET;
+
+	op = !ev_wait ? EPOLL_CTL_DEL : !ev_fd->ev_reg ? EPOLL_CTL_ADD :
+			EPOLL_CTL_MOD;
+	if (epoll_ctl(ep->epfd, op, ev_fd->fd, &ev) == 0) return 0;
+	r = errno;
+
+	// kernel dropped the FD when closed
+	if (op == EPOLL_CTL_DEL) return 0;
+
+	// FD closed and reused before cancel
+	if (op == EPOLL_CTL_MOD && r == ENOENT) {
+		if (epoll_ctl(ep->epfd, EPOLL_CTL_ADD, ev_fd->fd, &ev) == 0) return 0;
+		r = errno;
+	} else if (op == EPOLL_CTL_ADD && r == EEXIST) {
+		if (epoll_ctl(ep->epfd, EPOLL_CTL_MOD, ev_fd->fd, &ev) == 0) return 0;
+		r = errno;
+	}
+
+	// mimic select() that regular file always ready
+	if (r == EPERM) return ep_noep_add(ep, ev_fd);
+	return r;
+}
+
+/** Wait with timeout in nano-seconds, -1 and errno when failed. */
+static int ep_wait_hires(ep_t *ep, const struct timespec *tmo) {
+#ifdef HAVE_SYS_TIMERFD_H
+	struct itimerspec its = {.it_value = *tmo};
+#endif
+
+#ifdef HAVE_EPOLL_PWAIT2
+	if (!ep->flag.nopwait2) {
+		int cnt;
+
+		if ((cnt = epoll_pwait2(ep->epfd, ep->evs, ep->evs_cap, tmo,
+				NULL)) >= 0 || errno != ENOSYS) {
+			return cnt;
+		}
+		ep->flag.nopwait2 = 1;
+	}
+#endif
+
+#ifdef HAVE_SYS_TIMERFD_H
+	// timerfd reported with NULL data
+	if (ep->tfd == -1) {
+		struct epoll_event ev = {.events = EPOLLIN, .data = {.ptr = NULL}};
+
+		if ((ep->tfd = timerfd_create(CLOCK_MONOTONIC,
+				TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+			return -1;
+		}
+		if (epoll_ctl(ep->epfd, EPOLL_CTL_ADD, ep->tfd, &ev) != 0) {
+			int r = errno;
+
+			close(ep->tfd);
+			ep->tfd = -1;
+			errno = r;
+			return -1;
+		}
+	}
+	if (timerfd_settime(ep->tfd, 0, &its, NULL) != 0) return -1;
+	return epoll_wait(ep->epfd, ep->evs, ep->evs_cap, -1);
+#else
+	return epoll_wait(ep->epfd, ep->evs, ep->evs_cap,
+			tmo->tv_sec * 1000 + (tmo->tv_nsec + 999999ul) / 1000000ul);
+#endif
+}
+
+static int ep_wait(aloe_ev_ctx_t *ctx, const struct timespec *tmo) {
+	ep_t *ep = (ep_t*)ctx->backend_ctx;
+	int r, i, cnt, tmr;
+
+	if (ctx->flag.hires && tmo && ep->noep_cnt <= 0
+			&& tmo->tv_sec < INT_MAX / 1000 - 1
+			&& (tmo->tv_sec > 0 || tmo->tv_nsec > 0)) {
+		if ((cnt = ep_wait_hires(ep, tmo)) < 0) {
+			r = errno;
+			log_e("Failed to wait IO: %s(%d)\n", strerror(r), r);
+			return r;
+		}
+		goto fetched;
+	}
+
+	if (ep->noep_cnt > 0) {
+		tmr = 0;
+	} else if (!tmo) {
+		tmr = -1;
+	} else if (tmo->tv_sec >= INT_MAX / 1000 - 1) {
+		tmr = INT_MAX;
+	} else {
+		// round up to prevent wakeup before due
+		tmr = tmo->tv_sec * 1000 + (tmo->tv_nsec + 999999ul) / 1000000ul;
+	}
+
+	if ((cnt = epoll_wait(ep->epfd, ep->evs, ep->evs_cap, tmr)) < 0) {
+		r = errno;
+		log_e("Failed to wait IO: %s(%d)\n", strerror(r), r);
+		return r;
+	}
+
+fetched:
+	for (i = 0; i < cnt; i++) {
+		aloe_ev_ctx_fd_t *ev_fd = (aloe_ev_ctx_fd_t*)ep->evs[i].data.ptr;
+		uint32_t events = ep->evs[i].events;
+		unsigned triggered = 0;
+
+		if (!ev_fd) {
+			uint64_t expired;
+
+			// timerfd for timeout
+			while (read(ep->tfd, &expired, sizeof(expired)) > 0);
+			continue;
+		}
+
+		// mimic select() that hang up and error are readable and writable
+		if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+			triggered |= aloe_ev_flag_read;
+		}
+		if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+			triggered |= aloe_ev_flag_write;
+		}
+		if (events & EPOLLPRI) triggered |= aloe_ev_flag_except;
+		aloe_ev_fd_ready(ctx, ev_fd, triggered);
+	}
+
+	for (i = 0; i < ep->noep_cnt; i++) {
+		aloe_ev_fd_ready(ctx, ep->noep[i], ep->noep[i]->ev_reg
+				& (aloe_ev_flag_read | aloe_ev_flag_write | aloe_ev_flag_except));
+	}
+
+	// more event pending than fetched
+	if (cnt >= ep->evs_cap && ep->evs_cap < EPOLL_EVS_MAX) {
+		struct epoll_event *evs;
+
+		if ((evs = realloc(ep->evs, ep->evs_cap * 2 * sizeof(*evs)))) {
+			ep->evs = evs;
+			ep->evs_cap *= 2;
+		}
+	}
+	return 0;
+}
+
+const aloe_ev_backend_t aloe_ev_backend_epoll = {.name = "epoll",
+		.init = &ep_init, .destroy = &ep_destroy, .ctl = &ep_ctl,
+		.wait = &ep_wait};
@@ -0,0 +1,232 @@
+/**
+ * @author joelai
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "priv.h"
+
+#include <unistd.h>
+
+/** Try io_uring once, fallback to readiness. */
+static void io_engine_init(aloe_ev_ctx_t *ctx) {
+	if (ctx->flag.uring_chk) return;
+	ctx->flag.uring_chk = 1;
+#ifdef WITH_IO_URING
+	if (aloe_ev_uring_init(ctx) != 0) {
+		log_d("Fallback asynchronous IO to readiness\n");
+	}
+#endif
+}
+
+const char* aloe_ev_io_engine(void *_ctx) {
+	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)_ctx;
+
+	io_engine_init(ctx);
+	return ctx->uring ? "io_uring" : "readiness";
+}
+
+/** Perform the IO when ready, -1 and errno when failed. */
+static long io_perform(aloe_ev_ctx_io_t *io) {
+	switch (io->op) {
+	case aloe_ev_io_op_read:
+		return (io->off == -1) ? read(io->fd, io->buf, io->len) :
+				pread(io->fd, io->buf, io->len, io->off);
+	case aloe_ev_io_op_write:
+		return (io->off == -1) ? write(io->fd, io->buf, io->len) :
+				pwrite(io->fd, io->buf, io->len, io->off);
+	case aloe_ev_io_op_accept:
+		return accept(io->fd, io->sa, io->sa_len);
+	case aloe_ev_io_op_recv:
+		return recv(io->fd, io->buf, io->len, io->flags | MSG_DONTWAIT);
+	case aloe_ev_io_op_send:
+		return send(io->fd, io->buf, io->len, io->flags | MSG_DONTWAIT);
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+static void io_on_ready(int fd, unsigned ev_noti, void *cbarg);
+
+/** Wait the FD ready to perform the IO. */
+static int io_wait(aloe_ev_ctx_io_t *io) {
+	unsigned ev_wait = (io->op == aloe_ev_io_op_write
+			|| io->op == aloe_ev_io_op_send) ? aloe_ev_flag_write :
+			aloe_ev_flag_read;
+
+	if (!(io->ev = aloe_ev_put(io->ctx, io->fd, &io_on_ready, io, ev_wait,
+			ALOE_EV_INFINITE, 0))) {
+		return EIO;
+	}
+	return 0;
+}
+
+static void io_on_ready(int fd, unsigned ev_noti, void *cbarg) {
+	aloe_ev_ctx_io_t *io = (aloe_ev_ctx_io_t*)cbarg;
+	long res;
+	int r;
+
+	io->ev = NULL;
+	if ((res = io_perform(io)) < 0) {
+		r = errno;
+		// spurious wakeup
+		if ((ALOE_ENO_NONBLOCKING(r) || r == EWOULDBLOCK || r == EINTR)
+				&& (r = io_wait(io)) == 0) {
+			return;
+		}
+		res = -r;
+	}
+	aloe_ev_io_done(io->ctx, io, res);
+}
+
+void aloe_ev_io_done(aloe_ev_ctx_t *ctx, aloe_ev_ctx_io_t *io, long res) {
+	TAILQ_REMOVE(&ctx->io_q, io, qent);
+	(*io->cb)(io->fd, res, io->cbarg);
+	free(io);
+}
+
+void aloe_ev_io_destroy(aloe_ev_ctx_t *ctx) {
+	aloe_ev_ctx_io_t *io;
+
+#ifdef WITH_IO_URING
+	// kernel done with the IO before release
+	if (ctx->uring) aloe_ev_uring_destroy(ctx);
+#endif
+	while ((io = TAILQ_FIRST(&ctx->io_q))) {
+		TAILQ_REMOVE(&ctx->io_q, io, qent);
+		free(io);
+	}
+}
+
+/** Prepare the IO, errno when failed. */
+static int io_alloc(aloe_ev_ctx_t *ctx, aloe_ev_io_op_t op, int fd,
+		aloe_ev_io_cb_t cb, void *cbarg, aloe_ev_ctx_io_t **_io) {
+	aloe_ev_ctx_io_t *io;
+
+	if (fd < 0) {
+		log_e("invalid fd %d\n", fd);
+		return EBADF;
+	}
+	if (!(io = malloc(sizeof(*io)))) {
+		log_e("malloc io\n");
+		return ENOMEM;
+	}
+	io->op = op;
+	io->fd = fd;
+	io->buf = NULL;
+	io->len = 0;
+	io->off = -1;
+	io->flags = 0;
+	io->sa = NULL;
+	io->sa_len = NULL;
+	io->cb = cb;
+	io->cbarg = cbarg;
+	io->ctx = ctx;
+	io->ev = NULL;
+	*_io = io;
+	return 0;
+}
+
+/** Submit with io_uring or wait readiness, release the IO when failed. */
+static int io_submit(aloe_ev_ctx_t *ctx, aloe_ev_ctx_io_t *io) {
+	int r;
+
+	io_engine_init(ctx);
+#ifdef WITH_IO_URING
+	if (ctx->uring) {
+		if ((r = aloe_ev_uring_submit(ctx, io)) == 0) {
+			TAILQ_INSERT_TAIL(&ctx->io_q, io, qent);
+			return 0;
+		}
+		// opcode not supported by kernel, fallback to readiness
+		if (r != EOPNOTSUPP) {
+			log_e("Failed submit io_uring: %s(%d)\n", strerror(r), r);
+			free(io);
+			return r;
+		}
+	}
+#endif
+	if ((r = io_wait(io)) != 0) {
+		log_e("Failed wait fd %d\n", io->fd);
+		free(io);
+		return r;
+	}
+	TAILQ_INSERT_TAIL(&ctx->io_q, io, qent);
+	return 0;
+}
+
+int aloe_ev_io_read(void *_ctx, int fd, void *buf, size_t len, long off,
+		aloe_ev_io_cb_t cb, void *cbarg) {
+	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)_ctx;
+	aloe_ev_ctx_io_t *io;
+	int r;
+
+	if ((r = io_alloc(ctx, aloe_ev_io_op_read, fd, cb, cbarg, &io)) != 0) {
+		return r;
+	}
+	io->buf = buf;
+	io->len = len;
+	io->off = off;
+	return io_submit(ctx, io);
+}
+
+int aloe_ev_io_write(void *_ctx, int fd, const void *buf, size_t len,
+		long off, aloe_ev_io_cb_t cb, void *cbarg) {
+	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)_ctx;
+	aloe_ev_ctx_io_t *io;
+	int r;
+
+	if ((r = io_alloc(ctx, aloe_ev_io_op_write, fd, cb, cbarg, &io)) != 0) {
+		return r;
+	}
+	io->buf = (void*)buf;
+	io->len = len;
+	io->off = off;
+	return io_submit(ctx, io);
+}
+
+int aloe_ev_io_accept(void *_ctx, int fd, struct sockaddr *sa,
+		socklen_t *sa_len, aloe_ev_io_cb_t cb, void *cbarg) {
+	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)_ctx;
+	aloe_ev_ctx_io_t *io;
+	int r;
+
+	if ((r = io_alloc(ctx, aloe_ev_io_op_accept, fd, cb, cbarg, &io)) != 0) {
+		return r;
+	}
+	io->sa = sa;
+	io->sa_len = sa_len;
+	return io_submit(ctx, io);
+}
+
+int aloe_ev_io_recv(void *_ctx, int fd, void *buf, size_t len, int flags,
+		aloe_ev_io_cb_t cb, void *cbarg) {
+	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)_ctx;
+	aloe_ev_ctx_io_t *io;
+	int r;
+
+	if ((r = io_alloc(ctx, aloe_ev_io_op_recv, fd, cb, cbarg, &io)) != 0) {
+		return r;
+	}
+	io->buf = buf;
+	io->len = len;
+	io->flags = flags;
+	return io_submit(ctx, io);
+}
+
+int aloe_ev_io_send(void *_ctx, int fd, const void *buf, size_t len,
+		int flags, aloe_ev_io_cb_t cb, void *cbarg) {
+	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)_ctx;
+	aloe_ev_ctx_io_t *io;
+	int r;
+
+	if ((r = io_alloc(ctx, aloe_ev_io_op_send, fd, cb, cbarg, &io)) != 0) {
+		return r;
+	}
+	io->buf = (void*)buf;
+	io->len = len;
+	io->flags = flags;
+	return io_submit(ctx, io);
+}
@@ -0,0 +1,121 @@
+/**
+ * @author joelai
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "priv.h"
+
+#include <stdint.h>
+
+/** Size and alignment of slab, lookup slab by masking record address. */
+#define ALOE_EV_SLAB_SIZE (16 * 1024ul)
+
+/** Records start at cache line after the header. */
+#define ALOE_EV_SLAB_HDR ((sizeof(aloe_ev_slab_t) + 63ul) & ~63ul)
+
+#define slab_of(_rec) ((aloe_ev_slab_t*)((uintptr_t)(_rec) & \
+		~(ALOE_EV_SLAB_SIZE - 1)))
+
+#define rec_link(_pool, _rec) (*(void**)((char*)(_rec) + (_pool)->link_off))
+
+void aloe_ev_pool_init(aloe_ev_pool_t *pool, size_t rec_sz, size_t link_off,
+		unsigned long spare_max) {
+	// keep pointer aligned
+	pool->rec_sz = (rec_sz + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+	pool->link_off = link_off;
+	pool->slab_rec = (ALOE_EV_SLAB_SIZE - ALOE_EV_SLAB_HDR) / pool->rec_sz;
+	TAILQ_INIT(&pool->part_q);
+	TAILQ_INIT(&pool->full_q);
+	pool->spare_max = spare_max;
+	memset(&pool->stat, 0, sizeof(pool->stat));
+}
+
+static aloe_ev_slab_t* slab_alloc(aloe_ev_pool_t *pool) {
+	aloe_ev_slab_t *slab;
+	char *rec;
+	int i;
+
+	if (posix_memalign((void**)&slab, ALOE_EV_SLAB_SIZE, ALOE_EV_SLAB_SIZE)
+			!= 0) {
+		return NULL;
+	}
+	slab->used = 0;
+	slab->spare = NULL;
+	// lower address on top
+	rec = (char*)slab + ALOE_EV_SLAB_HDR + (pool->slab_rec - 1) * pool->rec_sz;
+	for (i = 0; i < pool->slab_rec; i++, rec -= pool->rec_sz) {
+		rec_link(pool, rec) = slab->spare;
+		slab->spare = rec;
+	}
+	TAILQ_INSERT_TAIL(&pool->part_q, slab, qent);
+	pool->stat.slab++;
+	pool->stat.slab_alloc++;
+	pool->stat.spare += pool->slab_rec;
+	return slab;
+}
+
+int aloe_ev_pool_reserve(aloe_ev_pool_t *pool, unsigned long cnt) {
+	while (pool->stat.spare < cnt) {
+		if (!slab_alloc(pool)) return ENOMEM;
+	}
+	return 0;
+}
+
+void* aloe_ev_pool_get(aloe_ev_pool_t *pool) {
+	aloe_ev_slab_t *slab;
+	void *rec;
+
+	if (!(slab = TAILQ_FIRST(&pool->part_q)) && !(slab = slab_alloc(pool))) {
+		return NULL;
+	}
+	rec = slab->spare;
+	slab->spare = rec_link(pool, rec);
+	if (++slab->used >= pool->slab_rec) {
+		TAILQ_REMOVE(&pool->part_q, slab, qent);
+		TAILQ_INSERT_TAIL(&pool->full_q, slab, qent);
+	}
+	pool->stat.used++;
+	pool->stat.spare--;
+	return rec;
+}
+
+void aloe_ev_pool_put(aloe_ev_pool_t *pool, void *rec) {
+	aloe_ev_slab_t *slab = slab_of(rec);
+
+	rec_link(pool, rec) = slab->spare;
+	slab->spare = rec;
+	pool->stat.used--;
+	pool->stat.spare++;
+	if (slab->used-- >= pool->slab_rec) {
+		// fill most used slab first
+		TAILQ_REMOVE(&pool->full_q, slab, qent);
+		TAILQ_INSERT_HEAD(&pool->part_q, slab, qent);
+		return;
+	}
+	if (slab->used > 0 || !pool->spare_max
+			|| pool->stat.spare < pool->spare_max + pool->slab_rec) {
+		return;
+	}
+	TAILQ_REMOVE(&pool->part_q, slab, qent);
+	free(slab);
+	pool->stat.slab--;
+	pool->stat.slab_free++;
+	pool->stat.spare -= pool->slab_rec;
+}
+
+void aloe_ev_pool_destroy(aloe_ev_pool_t *pool) {
+	aloe_ev_slab_t *slab;
+
+	while ((slab = TAILQ_FIRST(&pool->part_q))) {
+		TAILQ_REMOVE(&pool->part_q, slab, qent);
+		free(slab);
+	}
+	while ((slab = TAILQ_FIRST(&pool->full_q))) {
+		TAILQ_REMOVE(&pool->full_q, slab, qent);
+		free(slab);
+	}
+	pool->stat.used = pool->stat.spare = pool->stat.slab = 0;
+}
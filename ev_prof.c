@@ -0,0 +1,175 @@
+/**
+ * @author joelai
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "priv.h"
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Slot for the callback, open addressing by the loop thread only.
+ *
+ * Slot taken never released, reader in other thread load cb to tell taken.
+ */
+static aloe_ev_prof_stat_t* prof_slot(aloe_ev_ctx_t *ctx,
+		aloe_ev_noti_cb_t cb) {
+	uintptr_t h = (uintptr_t)cb;
+	int i, idx;
+
+	h = (h >> 4) * 0x9E3779B97F4A7C15ull;
+	idx = (int)((h >> 24) % (ALOE_EV_PROF_SLOT - 1));
+	for (i = 0; i < ALOE_EV_PROF_SLOT - 1; i++) {
+		aloe_ev_prof_stat_t *stat = &ctx->prof[idx];
+		aloe_ev_noti_cb_t slot_cb = __atomic_load_n(&stat->cb,
+				__ATOMIC_RELAXED);
+
+		if (slot_cb == cb) return stat;
+		if (!slot_cb) {
+			__atomic_store_n(&stat->cb, cb, __ATOMIC_RELEASE);
+			return stat;
+		}
+		if (++idx >= ALOE_EV_PROF_SLOT - 1) idx = 0;
+	}
+	// the rest
+	return &ctx->prof[ALOE_EV_PROF_SLOT - 1];
+}
+
+int aloe_ev_prof_init(aloe_ev_ctx_t *ctx, unsigned long slow_us) {
+	if (!(ctx->prof = calloc(ALOE_EV_PROF_SLOT, sizeof(*ctx->prof)))) {
+		log_e("malloc profiling\n");
+		return ENOMEM;
+	}
+	ctx->prof_slow = slow_us * 1000ul;
+	return 0;
+}
+
+void aloe_ev_prof_destroy(aloe_ev_ctx_t *ctx) {
+	if (!ctx->prof) return;
+	free(ctx->prof);
+	ctx->prof = NULL;
+}
+
+void aloe_ev_prof_enter(aloe_ev_ctx_t *ctx, aloe_ev_prof_ts_t *ts) {
+	(void)ctx;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts->cpu);
+	clock_gettime(CLOCK_MONOTONIC, &ts->wall);
+}
+
+void aloe_ev_prof_leave(aloe_ev_ctx_t *ctx, aloe_ev_noti_cb_t cb,
+		const aloe_ev_prof_ts_t *ts) {
+	aloe_ev_prof_stat_t *stat;
+	struct timespec wall, cpu;
+	unsigned long wall_ns, cpu_ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+	ALOE_TIMESEC_SUB(wall.tv_sec, wall.tv_nsec, ts->wall.tv_sec,
+			ts->wall.tv_nsec, wall.tv_sec, wall.tv_nsec, 1000000000ul);
+	ALOE_TIMESEC_SUB(cpu.tv_sec, cpu.tv_nsec, ts->cpu.tv_sec,
+			ts->cpu.tv_nsec, cpu.tv_sec, cpu.tv_nsec, 1000000000ul);
+	wall_ns = wall.tv_sec * 1000000000ul + wall.tv_nsec;
+	cpu_ns = cpu.tv_sec * 1000000000ul + cpu.tv_nsec;
+
+	stat = prof_slot(ctx, cb);
+	__atomic_fetch_add(&stat->cnt, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stat->wall_ns, wall_ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stat->cpu_ns, cpu_ns, __ATOMIC_RELAXED);
+	if (wall_ns > __atomic_load_n(&stat->max_ns, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&stat->max_ns, wall_ns, __ATOMIC_RELAXED);
+	}
+
+	// watchdog
+	if (ctx->prof_slow > 0 && wall_ns > ctx->prof_slow) {
+		const char *name = __atomic_load_n(&stat->name, __ATOMIC_ACQUIRE);
+
+		__atomic_fetch_add(&stat->slow, 1, __ATOMIC_RELAXED);
+		log_e("Slow callback %s(%p) took %luus, cpu %luus\n",
+				(name ? name : "-"), (void*)cb, wall_ns / 1000ul,
+				cpu_ns / 1000ul);
+	}
+}
+
+int aloe_ev_prof_name(void *_ctx, aloe_ev_noti_cb_t cb, const char *name) {
+	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)_ctx;
+	aloe_ev_prof_stat_t *stat;
+
+	if (!ctx->prof) return EINVAL;
+	if ((stat = prof_slot(ctx, cb)) == &ctx->prof[ALOE_EV_PROF_SLOT - 1]) {
+		return ENOSPC;
+	}
+	__atomic_store_n(&stat->name, name, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int aloe_ev_prof_get(void *_ctx, aloe_ev_prof_stat_t *stat, int cnt,
+		int reset) {
+	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)_ctx;
+	int i, num = 0;
+
+	if (!ctx->prof) return 0;
+	for (i = 0; i < ALOE_EV_PROF_SLOT; i++) {
+		aloe_ev_prof_stat_t *slot = &ctx->prof[i];
+		aloe_ev_noti_cb_t cb = __atomic_load_n(&slot->cb, __ATOMIC_ACQUIRE);
+		unsigned long slot_cnt;
+
+		if (!cb && i < ALOE_EV_PROF_SLOT - 1) continue;
+		slot_cnt = (reset ? __atomic_exchange_n(&slot->cnt, 0,
+				__ATOMIC_RELAXED) : __atomic_load_n(&slot->cnt,
+				__ATOMIC_RELAXED));
+		if (slot_cnt == 0 && !reset) continue;
+		if (stat && num < cnt) {
+			aloe_ev_prof_stat_t *s = &stat[num];
+
+			s->cb = cb;
+			s->name = __atomic_load_n(&slot->name, __ATOMIC_ACQUIRE);
+			s->cnt = slot_cnt;
+#define PROF_FETCH(_f) (reset ? __atomic_exchange_n(&slot->_f, 0, \
+		__ATOMIC_RELAXED) : __atomic_load_n(&slot->_f, __ATOMIC_RELAXED))
+			s->wall_ns = PROF_FETCH(wall_ns);
+			s->cpu_ns = PROF_FETCH(cpu_ns);
+			s->max_ns = PROF_FETCH(max_ns);
+			s->slow = PROF_FETCH(slow);
+#undef PROF_FETCH
+			if (slot_cnt > 0) num++;
+		} else if (reset) {
+			__atomic_store_n(&slot->wall_ns, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&slot->cpu_ns, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&slot->max_ns, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&slot->slow, 0, __ATOMIC_RELAXED);
+		}
+	}
+	return num;
+}
+
+static int prof_cmp(const void *a, const void *b) {
+	unsigned long wa = ((const aloe_ev_prof_stat_t*)a)->wall_ns;
+	unsigned long wb = ((const aloe_ev_prof_stat_t*)b)->wall_ns;
+
+	return (wa < wb) ? 1 : (wa > wb) ? -1 : 0;
+}
+
+void aloe_ev_prof_dump(void *ctx, int reset) {
+	aloe_ev_prof_stat_t *stat;
+	int i, cnt;
+
+	if (!(stat = malloc(ALOE_EV_PROF_SLOT * sizeof(*stat)))) {
+		log_e("malloc profiling dump\n");
+		return;
+	}
+	cnt = aloe_ev_prof_get(ctx, stat, ALOE_EV_PROF_SLOT, reset);
+	qsort(stat, cnt, sizeof(*stat), &prof_cmp);
+	for (i = 0; i < cnt; i++) {
+		aloe_ev_prof_stat_t *s = &stat[i];
+
+		log_i("%s(%p) cnt %lu wall %luus cpu %luus avg %luns max %luns "
+				"slow %lu\n", (s->name ? s->name : s->cb ? "-" : "(rest)"),
+				(void*)s->cb, s->cnt, s->wall_ns / 1000ul, s->cpu_ns / 1000ul,
+				s->wall_ns / s->cnt, s->max_ns, s->slow);
+	}
+	free(stat);
+}
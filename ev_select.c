@@ -0,0 +1,101 @@
+/**
+ * @author joelai
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "priv.h"
+
+#include <sys/select.h>
+
+/** Interest set keep between wait. */
+typedef struct {
+	fd_set rdset, wrset, exset;
+	int fdmax;
+} sel_t;
+
+static int sel_init(aloe_ev_ctx_t *ctx) {
+	sel_t *sel;
+
+	if (!(sel = malloc(sizeof(*sel)))) {
+		log_e("malloc select backend\n");
+		return ENOMEM;
+	}
+	FD_ZERO(&sel->rdset); FD_ZERO(&sel->wrset); FD_ZERO(&sel->exset);
+	sel->fdmax = -1;
+	ctx->backend_ctx = (void*)sel;
+	return 0;
+}
+
+static void sel_destroy(aloe_ev_ctx_t *ctx) {
+	if (ctx->backend_ctx) free(ctx->backend_ctx);
+	ctx->backend_ctx = NULL;
+}
+
+static int sel_ctl(aloe_ev_ctx_t *ctx, aloe_ev_ctx_fd_t *ev_fd,
+		unsigned ev_wait) {
+	sel_t *sel = (sel_t*)ctx->backend_ctx;
+	int fd = ev_fd->fd;
+
+	if (fd < 0 || fd >= FD_SETSIZE) return EINVAL;
+
+	if (ev_wait & aloe_ev_flag_read) FD_SET(fd, &sel->rdset);
+	else FD_CLR(fd, &sel->rdset);
+	if (ev_wait & aloe_ev_flag_write) FD_SET(fd, &sel->wrset);
+	else FD_CLR(fd, &sel->wrset);
+	if (ev_wait & aloe_ev_flag_except) FD_SET(fd, &sel->exset);
+	else FD_CLR(fd, &sel->exset);
+
+	if (ev_wait) {
+		if (fd > sel->fdmax) sel->fdmax = fd;
+	} else if (fd == sel->fdmax) {
+		while (sel->fdmax >= 0 && !FD_ISSET(sel->fdmax, &sel->rdset)
+				&& !FD_ISSET(sel->fdmax, &sel->wrset)
+				&& !FD_ISSET(sel->fdmax, &sel->exset)) {
+			sel->fdmax--;
+		}
+	}
+	return 0;
+}
+
+static int sel_wait(aloe_ev_ctx_t *ctx, const struct timespec *tmo) {
+	sel_t *sel = (sel_t*)ctx->backend_ctx;
+	fd_set rdset = sel->rdset, wrset = sel->wrset, exset = sel->exset;
+	aloe_ev_ctx_fd_t *ev_fd;
+	int r, cnt;
+
+	// timeout in nano-seconds
+	if ((cnt = pselect(sel->fdmax + 1, &rdset, &wrset, &exset, tmo,
+			NULL)) < 0) {
+		r = errno;
+		log_e("Failed to wait IO: %s(%d)\n", strerror(r), r);
+		return r;
+	}
+
+	TAILQ_FOREACH(ev_fd, &ctx->fd_q, qent) {
+		unsigned triggered = 0;
+
+		if (cnt <= 0) break;
+		if (!ev_fd->ev_reg) continue;
+		if (FD_ISSET(ev_fd->fd, &rdset)) {
+			triggered |= aloe_ev_flag_read;
+			cnt--;
+		}
+		if (FD_ISSET(ev_fd->fd, &wrset)) {
+			triggered |= aloe_ev_flag_write;
+			cnt--;
+		}
+		if (FD_ISSET(ev_fd->fd, &exset)) {
+			triggered |= aloe_ev_flag_except;
+			cnt--;
+		}
+		if (triggered) aloe_ev_fd_ready(ctx, ev_fd, triggered);
+	}
+	return 0;
+}
+
+const aloe_ev_backend_t aloe_ev_backend_select = {.name = "select",
+		.init = &sel_init, .destroy = &sel_destroy, .ctl = &sel_ctl,
+		.wait = &sel_wait};
@@ -0,0 +1,197 @@
+/**
+ * @author joelai
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "priv.h"
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+/** Record in ring, 24 bytes. */
+typedef struct {
+	uint64_t ts; /**< Monotonic nano-seconds. */
+	const void *ptr;
+	int32_t arg;
+	uint32_t type;
+} trace_rec_t;
+
+/** Ring per thread. */
+typedef struct trace_ring_rec {
+	TAILQ_ENTRY(trace_ring_rec) qent;
+	long tid;
+	trace_rec_t *rec;
+	unsigned long mask; /**< Capacity in power of 2 minus 1. */
+	unsigned long head; /**< Count of record ever written. */
+	struct {
+		unsigned stopped: 1; /**< Owner thread not write any more. */
+	} flag;
+} trace_ring_t;
+
+typedef TAILQ_HEAD(trace_ring_queue_rec, trace_ring_rec) trace_ring_queue_t;
+
+__thread int aloe_ev_trace_on = 0;
+
+static __thread trace_ring_t *trace_ring = NULL;
+
+/** All ring to save. */
+static trace_ring_queue_t trace_ring_q = TAILQ_HEAD_INITIALIZER(trace_ring_q);
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void aloe_ev_trace_rec(aloe_ev_trace_t type, const void *ptr, long arg) {
+	trace_ring_t *ring = trace_ring;
+	trace_rec_t *rec = &ring->rec[ring->head & ring->mask];
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	rec->ts = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	rec->ptr = ptr;
+	rec->arg = (int32_t)arg;
+	rec->type = type;
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+int aloe_ev_trace_start(unsigned long rec_cnt) {
+	trace_ring_t *ring;
+	unsigned long cap;
+
+	if (trace_ring) {
+		aloe_ev_trace_on = 1;
+		return 0;
+	}
+	for (cap = 64; cap < rec_cnt; cap <<= 1);
+	if (!(ring = malloc(sizeof(*ring)))) {
+		log_e("malloc trace\n");
+		return ENOMEM;
+	}
+	if (!(ring->rec = malloc(cap * sizeof(*ring->rec)))) {
+		log_e("malloc trace record\n");
+		free(ring);
+		return ENOMEM;
+	}
+	ring->tid = (long)syscall(SYS_gettid);
+	ring->mask = cap - 1;
+	ring->head = 0;
+	ring->flag.stopped = 0;
+	pthread_mutex_lock(&trace_lock);
+	TAILQ_INSERT_TAIL(&trace_ring_q, ring, qent);
+	pthread_mutex_unlock(&trace_lock);
+	trace_ring = ring;
+	aloe_ev_trace_on = 1;
+	return 0;
+}
+
+void aloe_ev_trace_stop(void) {
+	aloe_ev_trace_on = 0;
+	if (!trace_ring) return;
+	pthread_mutex_lock(&trace_lock);
+	trace_ring->flag.stopped = 1;
+	pthread_mutex_unlock(&trace_lock);
+	trace_ring = NULL;
+}
+
+void aloe_ev_trace_clear(void) {
+	trace_ring_t *ring, *ring_safe;
+
+	pthread_mutex_lock(&trace_lock);
+	TAILQ_FOREACH_SAFE(ring, &trace_ring_q, qent, ring_safe) {
+		if (!ring->flag.stopped) continue;
+		TAILQ_REMOVE(&trace_ring_q, ring, qent);
+		free(ring->rec);
+		free(ring);
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/** Write a record as trace event. */
+static void trace_json_rec(FILE *fp, const trace_rec_t *rec, long pid,
+		long tid, int *cnt) {
+	static const struct {
+		const char *name, *ph;
+	} lut[] = {
+		[aloe_ev_trace_wait] = {"wait", "B"},
+		[aloe_ev_trace_wakeup] = {"wait", "E"},
+		[aloe_ev_trace_cb] = {NULL, "B"},
+		[aloe_ev_trace_cb_end] = {NULL, "E"},
+		[aloe_ev_trace_tmr] = {NULL, "i"},
+		[aloe_ev_trace_mod] = {NULL, "B"},
+		[aloe_ev_trace_mod_end] = {NULL, "E"},
+	};
+
+	if (rec->type >= aloe_arraysize(lut)) return;
+	fprintf(fp, "%s\n{\"ph\":\"%s\",\"pid\":%ld,\"tid\":%ld,\"ts\":%llu.%03u",
+			(*cnt)++ ? "," : "", lut[rec->type].ph, pid, tid,
+			(unsigned long long)(rec->ts / 1000ull),
+			(unsigned)(rec->ts % 1000ull));
+	switch (rec->type) {
+	case aloe_ev_trace_wait:
+		fprintf(fp, ",\"name\":\"wait\",\"args\":{\"tmo_us\":%d}}",
+				(int)rec->arg);
+		break;
+	case aloe_ev_trace_cb:
+	case aloe_ev_trace_cb_end:
+		fprintf(fp, ",\"name\":\"cb %p\",\"cat\":\"cb\","
+				"\"args\":{\"fd\":%d}}", rec->ptr, (int)rec->arg);
+		break;
+	case aloe_ev_trace_tmr:
+		fprintf(fp, ",\"name\":\"tmr %p\",\"cat\":\"tmr\",\"s\":\"t\"}",
+				rec->ptr);
+		break;
+	case aloe_ev_trace_mod:
+	case aloe_ev_trace_mod_end:
+		fprintf(fp, ",\"name\":\"%s init\",\"cat\":\"mod\"}",
+				(rec->ptr ? (const char*)rec->ptr : "mod"));
+		break;
+	default:
+		fprintf(fp, ",\"name\":\"%s\"}", lut[rec->type].name);
+		break;
+	}
+}
+
+int aloe_ev_trace_save(const char *path) {
+	trace_ring_t *ring;
+	FILE *fp;
+	long pid = (long)getpid();
+	int r, cnt = 0;
+
+	if (!(fp = fopen(path, "w"))) {
+		r = errno;
+		log_e("Failed open %s: %s(%d)\n", path, strerror(r), r);
+		return r;
+	}
+	fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	pthread_mutex_lock(&trace_lock);
+	TAILQ_FOREACH(ring, &trace_ring_q, qent) {
+		unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		unsigned long i = (head > ring->mask + 1) ? head - ring->mask - 1 : 0;
+		trace_rec_t rec;
+
+		// oldest record in ring first
+		for ( ; i < head; i++) {
+			rec = ring->rec[i & ring->mask];
+
+			// live ring writes the slot at head, drop the copy when owner
+			// thread wrapped onto it while copying
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&ring->head, __ATOMIC_RELAXED) - i
+					> ring->mask) {
+				continue;
+			}
+			trace_json_rec(fp, &rec, pid, ring->tid, &cnt);
+		}
+	}
+	pthread_mutex_unlock(&trace_lock);
+	fprintf(fp, "\n]}\n");
+	if (fclose(fp) != 0) {
+		r = errno;
+		log_e("Failed write %s: %s(%d)\n", path, strerror(r), r);
+		return r;
+	}
+	return 0;
+}
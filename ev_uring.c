@@ -0,0 +1,388 @@
+/**
+ * @author joelai
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "priv.h"
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/** Submission queue entries. */
+#define URING_ENTRIES 256
+
+/** Rings shared with kernel. */
+typedef struct {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, *sq_flags;
+	unsigned sq_entries;
+	unsigned sq_pend; /**< Queued but not submitted. */
+	unsigned io_cnt; /**< IO queued or in flight, completion not reaped. */
+	struct io_uring_sqe *sqes;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_sz, cq_sz, sqes_sz;
+	void *ev; /**< Notify when completion queued. */
+	unsigned op_ok; /**< Bit of aloe_ev_io_op_t supported by kernel. */
+} ur_t;
+
+/** Opcode for aloe_ev_io_op_t. */
+static const unsigned char ur_op_lut[] = {
+	[aloe_ev_io_op_read] = IORING_OP_READ,
+	[aloe_ev_io_op_write] = IORING_OP_WRITE,
+	[aloe_ev_io_op_accept] = IORING_OP_ACCEPT,
+	[aloe_ev_io_op_recv] = IORING_OP_RECV,
+	[aloe_ev_io_op_send] = IORING_OP_SEND,
+};
+
+static int ur_setup(unsigned entries, struct io_uring_params *p) {
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int ur_enter(int fd, unsigned to_submit, unsigned min_complete,
+		unsigned flags) {
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			flags, NULL, 0);
+}
+
+static int ur_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/** Opcode supported by kernel, none when probe not supported before 5.6. */
+static unsigned ur_probe(ur_t *ur) {
+	struct io_uring_probe *probe;
+	size_t sz = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+	unsigned op_ok = 0;
+	int i, r;
+
+	if (!(probe = calloc(1, sz))) {
+		log_e("malloc io_uring probe\n");
+		return 0;
+	}
+	if (ur_register(ur->fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+		r = errno;
+		log_d("io_uring probe unavailable: %s(%d)\n", strerror(r), r);
+		free(probe);
+		return 0;
+	}
+	// required to stop IO in flight when destroy
+	if (IORING_OP_ASYNC_CANCEL > probe->last_op
+			|| !(probe->ops[IORING_OP_ASYNC_CANCEL].flags
+			& IO_URING_OP_SUPPORTED)) {
+		log_d("io_uring cancel unavailable\n");
+		free(probe);
+		return 0;
+	}
+	for (i = 0; i < (int)aloe_arraysize(ur_op_lut); i++) {
+		unsigned op = ur_op_lut[i];
+
+		if (op <= probe->last_op
+				&& (probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+			op_ok |= (1 << i);
+		}
+	}
+	free(probe);
+	return op_ok;
+}
+
+static void ur_unmap(ur_t *ur) {
+	if (ur->sqes && ur->sqes != MAP_FAILED) munmap(ur->sqes, ur->sqes_sz);
+	if (ur->cq_ptr && ur->cq_ptr != MAP_FAILED && ur->cq_ptr != ur->sq_ptr) {
+		munmap(ur->cq_ptr, ur->cq_sz);
+	}
+	if (ur->sq_ptr && ur->sq_ptr != MAP_FAILED) munmap(ur->sq_ptr, ur->sq_sz);
+}
+
+/** Submit queued entries, 0 or errno with the rest left queued. */
+static int ur_submit(ur_t *ur) {
+	int r;
+
+	while (ur->sq_pend > 0) {
+		if ((r = ur_enter(ur->fd, ur->sq_pend, 0, 0)) < 0) {
+			if ((r = errno) == EINTR) continue;
+			return r;
+		}
+		// kernel advance head for entries taken, even partial or failed
+		ur->sq_pend = *ur->sq_tail - __atomic_load_n(ur->sq_head,
+				__ATOMIC_ACQUIRE);
+		if (r == 0) return EAGAIN;
+	}
+	return 0;
+}
+
+/** Take back entries not taken by kernel, return count of the IO. */
+static unsigned ur_rewind(ur_t *ur, aloe_ev_ctx_io_t **io) {
+	unsigned head = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE), i;
+	unsigned cnt = 0;
+
+	for (i = head; i != *ur->sq_tail; i++) {
+		struct io_uring_sqe *sqe = &ur->sqes[ur->sq_array[i & *ur->sq_mask]];
+
+		if (sqe->user_data) {
+			io[cnt++] = (aloe_ev_ctx_io_t*)(uintptr_t)sqe->user_data;
+		}
+	}
+	__atomic_store_n(ur->sq_tail, head, __ATOMIC_RELEASE);
+	ur->sq_pend = 0;
+	ur->io_cnt -= cnt;
+	return cnt;
+}
+
+/** Entry to fill, NULL when queue full. */
+static struct io_uring_sqe* ur_sqe_get(ur_t *ur) {
+	unsigned tail = *ur->sq_tail;
+	struct io_uring_sqe *sqe;
+
+	if (tail - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE)
+			>= ur->sq_entries) {
+		return NULL;
+	}
+	sqe = &ur->sqes[tail & *ur->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+/** Queue the entry from ur_sqe_get(). */
+static void ur_sqe_push(ur_t *ur) {
+	unsigned tail = *ur->sq_tail, idx = tail & *ur->sq_mask;
+
+	ur->sq_array[idx] = idx;
+	__atomic_store_n(ur->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ur->sq_pend++;
+}
+
+/** Reap completion and callback. */
+static void ur_on_read(int fd, unsigned ev_noti, void *cbarg) {
+	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)cbarg;
+	ur_t *ur = (ur_t*)ctx->uring;
+	unsigned head, tail;
+
+	head = *ur->cq_head;
+	tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+	while (1) {
+		struct io_uring_cqe *cqe;
+		aloe_ev_ctx_io_t *io;
+		long res;
+
+		if (head == tail) {
+			// completion more than queue kept in kernel until asked
+			if (!(__atomic_load_n(ur->sq_flags, __ATOMIC_ACQUIRE)
+					& IORING_SQ_CQ_OVERFLOW)
+					|| ur_enter(ur->fd, 0, 0, IORING_ENTER_GETEVENTS) < 0) {
+				break;
+			}
+			if ((tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE))
+					== head) {
+				break;
+			}
+		}
+		cqe = &ur->cqes[head & *ur->cq_mask];
+		io = (aloe_ev_ctx_io_t*)(uintptr_t)cqe->user_data;
+		res = cqe->res;
+
+		// release the entry before callback that may submit more
+		__atomic_store_n(ur->cq_head, ++head, __ATOMIC_RELEASE);
+		if (!io) continue;
+		ur->io_cnt--;
+		aloe_ev_io_done(ctx, io, res);
+		if (head == tail) tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+	}
+}
+
+int aloe_ev_uring_init(aloe_ev_ctx_t *ctx) {
+	struct io_uring_params p;
+	ur_t *ur;
+	int r;
+
+	if (!(ur = calloc(1, sizeof(*ur)))) {
+		log_e("malloc io_uring\n");
+		return ENOMEM;
+	}
+	memset(&p, 0, sizeof(p));
+	if ((ur->fd = ur_setup(URING_ENTRIES, &p)) == -1) {
+		r = errno;
+		log_d("io_uring unavailable: %s(%d)\n", strerror(r), r);
+		free(ur);
+		return r;
+	}
+
+	// kernel might have io_uring but not the opcode
+	if (!(ur->op_ok = ur_probe(ur))) {
+		log_d("io_uring opcode unavailable\n");
+		close(ur->fd);
+		free(ur);
+		return EOPNOTSUPP;
+	}
+
+	ur->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ur->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ur->cq_sz > ur->sq_sz) ur->sq_sz = ur->cq_sz;
+		ur->cq_sz = ur->sq_sz;
+	}
+	if ((ur->sq_ptr = mmap(NULL, ur->sq_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING))
+			== MAP_FAILED) {
+		r = errno;
+		log_e("Failed map io_uring submission: %s(%d)\n", strerror(r), r);
+		goto finally;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ur->cq_ptr = ur->sq_ptr;
+	} else if ((ur->cq_ptr = mmap(NULL, ur->cq_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_CQ_RING))
+			== MAP_FAILED) {
+		r = errno;
+		log_e("Failed map io_uring completion: %s(%d)\n", strerror(r), r);
+		goto finally;
+	}
+	ur->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	if ((ur->sqes = mmap(NULL, ur->sqes_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES))
+			== MAP_FAILED) {
+		r = errno;
+		log_e("Failed map io_uring entries: %s(%d)\n", strerror(r), r);
+		goto finally;
+	}
+	ur->sq_head = (unsigned*)((char*)ur->sq_ptr + p.sq_off.head);
+	ur->sq_tail = (unsigned*)((char*)ur->sq_ptr + p.sq_off.tail);
+	ur->sq_mask = (unsigned*)((char*)ur->sq_ptr + p.sq_off.ring_mask);
+	ur->sq_array = (unsigned*)((char*)ur->sq_ptr + p.sq_off.array);
+	ur->sq_flags = (unsigned*)((char*)ur->sq_ptr + p.sq_off.flags);
+	// bound for IO taken back at once
+	ur->sq_entries = aloe_min(p.sq_entries, URING_ENTRIES);
+	ur->cq_head = (unsigned*)((char*)ur->cq_ptr + p.cq_off.head);
+	ur->cq_tail = (unsigned*)((char*)ur->cq_ptr + p.cq_off.tail);
+	ur->cq_mask = (unsigned*)((char*)ur->cq_ptr + p.cq_off.ring_mask);
+	ur->cqes = (struct io_uring_cqe*)((char*)ur->cq_ptr + p.cq_off.cqes);
+
+	// ring FD readable when completion queued
+	if (!(ur->ev = aloe_ev_put(ctx, ur->fd, &ur_on_read, ctx,
+			aloe_ev_flag_read | aloe_ev_flag_persist, ALOE_EV_INFINITE, 0))) {
+		r = EIO;
+		log_e("Failed schedule io_uring completion\n");
+		goto finally;
+	}
+	ctx->fd_sys++;
+	ctx->uring = (void*)ur;
+	r = 0;
+finally:
+	if (r != 0) {
+		ur_unmap(ur);
+		close(ur->fd);
+		free(ur);
+	}
+	return r;
+}
+
+void aloe_ev_uring_destroy(aloe_ev_ctx_t *ctx) {
+	ur_t *ur = (ur_t*)ctx->uring;
+	aloe_ev_ctx_io_t *io, *io_rew[URING_ENTRIES];
+	struct io_uring_sqe *sqe;
+	unsigned head, tail;
+	int r;
+
+	if (!ur) return;
+
+	// not taken by kernel, nothing to wait
+	if (ur_submit(ur) != 0) ur_rewind(ur, io_rew);
+
+	// kernel may write buffer of IO in flight, cancel and wait completion
+	TAILQ_FOREACH(io, &ctx->io_q, qent) {
+		if (io->ev || ur->io_cnt == 0) continue;
+		if (!(sqe = ur_sqe_get(ur))) {
+			if (ur_submit(ur) != 0 || !(sqe = ur_sqe_get(ur))) break;
+		}
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = (uintptr_t)io;
+		ur_sqe_push(ur);
+	}
+	if ((r = ur_submit(ur)) != 0) {
+		log_e("Failed cancel io_uring: %s(%d)\n", strerror(r), r);
+		ur->io_cnt = 0;
+	}
+	while (ur->io_cnt > 0) {
+		head = *ur->cq_head;
+		if (head == (tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE))) {
+			if (ur_enter(ur->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0
+					&& (r = errno) != EINTR) {
+				log_e("Failed wait io_uring: %s(%d)\n", strerror(r), r);
+				break;
+			}
+			continue;
+		}
+		// the cancel itself completed without user data
+		for ( ; head != tail; head++) {
+			if (ur->cqes[head & *ur->cq_mask].user_data) ur->io_cnt--;
+		}
+		__atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	ur_unmap(ur);
+	close(ur->fd);
+	free(ur);
+	ctx->uring = NULL;
+}
+
+void aloe_ev_uring_flush(aloe_ev_ctx_t *ctx) {
+	ur_t *ur = (ur_t*)ctx->uring;
+	aloe_ev_ctx_io_t *io[URING_ENTRIES];
+	unsigned cnt, i;
+	int r;
+
+	// kernel busy, retry next loop
+	if ((r = ur_submit(ur)) == 0 || r == EAGAIN || r == EBUSY) return;
+	log_e("Failed submit io_uring: %s(%d)\n", strerror(r), r);
+
+	// never taken by kernel, fail them instead of retry every loop
+	cnt = ur_rewind(ur, io);
+	for (i = 0; i < cnt; i++) aloe_ev_io_done(ctx, io[i], -r);
+}
+
+int aloe_ev_uring_submit(aloe_ev_ctx_t *ctx, aloe_ev_ctx_io_t *io) {
+	ur_t *ur = (ur_t*)ctx->uring;
+	struct io_uring_sqe *sqe;
+
+	if ((unsigned)io->op >= aloe_arraysize(ur_op_lut)) return EINVAL;
+	if (!(ur->op_ok & (1 << io->op))) return EOPNOTSUPP;
+	if (!(sqe = ur_sqe_get(ur))) {
+		// make room by submit earlier
+		ur_submit(ur);
+		if (!(sqe = ur_sqe_get(ur))) return EAGAIN;
+	}
+	sqe->opcode = ur_op_lut[io->op];
+	sqe->fd = io->fd;
+	sqe->user_data = (uintptr_t)io;
+	switch (io->op) {
+	case aloe_ev_io_op_read:
+	case aloe_ev_io_op_write:
+		sqe->addr = (uintptr_t)io->buf;
+		sqe->len = io->len;
+		sqe->off = (uint64_t)io->off;
+		break;
+	case aloe_ev_io_op_accept:
+		sqe->addr = (uintptr_t)io->sa;
+		sqe->addr2 = (uintptr_t)io->sa_len;
+		break;
+	case aloe_ev_io_op_recv:
+	case aloe_ev_io_op_send:
+		sqe->addr = (uintptr_t)io->buf;
+		sqe->len = io->len;
+		sqe->msg_flags = io->flags;
+		break;
+	default:
+		return EINVAL;
+	}
+	ur_sqe_push(ur);
+	ur->io_cnt++;
+	return 0;
+}
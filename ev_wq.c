@@ -0,0 +1,314 @@
+/**
+ * @author joelai
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "priv.h"
+
+#include <unistd.h>
+#include <pthread.h>
+
+/** Queue of aloe_ev_job_t. */
+typedef TAILQ_HEAD(wq_job_queue_rec, aloe_ev_job_rec) wq_job_queue_t;
+
+struct wq_rec;
+
+/** Worker own a deque, take from head and stolen from tail. */
+typedef struct {
+	struct wq_rec *wq;
+	int id;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	wq_job_queue_t job_q;
+	struct {
+		unsigned started: 1;
+	} flag;
+} wq_worker_t;
+
+typedef struct wq_rec {
+	wq_worker_t *worker;
+	int worker_cnt;
+	unsigned submit_idx; /**< Round robin to worker, updated atomically. */
+
+	/** Worker sleep without job. */
+	pthread_mutex_t idle_lock;
+	pthread_cond_t idle_cond;
+	int idle_cnt;
+	int quit; /**< Stop taking job, updated atomically. */
+
+	/** Updated atomically. */
+	aloe_ev_wq_stat_t stat;
+} wq_t;
+
+/** Run job done in the loop, in order of completion. */
+static void wq_on_done(void *cbarg) {
+	aloe_ev_ctx_t *ctx = (aloe_ev_ctx_t*)cbarg;
+	aloe_ev_job_t *job, *next, *todo = NULL;
+
+	job = __atomic_exchange_n(&ctx->wq_done, NULL, __ATOMIC_ACQUIRE);
+	for ( ; job; job = next) {
+		next = job->next;
+		job->next = todo;
+		todo = job;
+	}
+	for ( ; todo; todo = next) {
+		next = todo->next;
+		if (todo->done) (*todo->done)(todo->r, todo->cbarg);
+		free(todo);
+	}
+}
+
+/** Deliver job to the loop, wakeup once per batch. */
+static void wq_complete(aloe_ev_job_t *job) {
+	aloe_ev_ctx_t *ctx = job->ctx;
+	aloe_ev_job_t *head;
+	int r;
+
+	head = __atomic_load_n(&ctx->wq_done, __ATOMIC_RELAXED);
+	do {
+		job->next = head;
+	} while (!__atomic_compare_exchange_n(&ctx->wq_done, &head, job, 1,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	// loop already asked to run the batch
+	if (head) return;
+	if ((r = aloe_ev_post(ctx, &wq_on_done, ctx)) != 0) {
+		log_e("Failed deliver job done: %s(%d)\n", strerror(r), r);
+	}
+}
+
+/** Take job from own head, or steal from tail of other worker. */
+static aloe_ev_job_t* wq_take(wq_worker_t *worker) {
+	wq_t *wq = worker->wq;
+	aloe_ev_job_t *job;
+	int i;
+
+	pthread_mutex_lock(&worker->lock);
+	if ((job = TAILQ_FIRST(&worker->job_q))) {
+		TAILQ_REMOVE(&worker->job_q, job, qent);
+	}
+	pthread_mutex_unlock(&worker->lock);
+	if (job) return job;
+
+	for (i = 1; i < wq->worker_cnt; i++) {
+		wq_worker_t *victim = &wq->worker[(worker->id + i) % wq->worker_cnt];
+
+		pthread_mutex_lock(&victim->lock);
+		if ((job = TAILQ_LAST(&victim->job_q, wq_job_queue_rec))) {
+			TAILQ_REMOVE(&victim->job_q, job, qent);
+		}
+		pthread_mutex_unlock(&victim->lock);
+		if (job) {
+			__atomic_fetch_add(&wq->stat.steal, 1, __ATOMIC_RELAXED);
+			return job;
+		}
+	}
+	return NULL;
+}
+
+static void* wq_worker_main(void *arg) {
+	wq_worker_t *worker = (wq_worker_t*)arg;
+	wq_t *wq = worker->wq;
+	aloe_ev_job_t *job;
+
+	while (1) {
+		int state = aloe_ev_job_state_queued;
+
+		// the rest cancelled by destroy
+		if (__atomic_load_n(&wq->quit, __ATOMIC_ACQUIRE)) break;
+		if (!(job = wq_take(worker))) {
+			pthread_mutex_lock(&wq->idle_lock);
+			while (!wq->quit && __atomic_load_n(&wq->stat.depth,
+					__ATOMIC_ACQUIRE) == 0) {
+				wq->idle_cnt++;
+				pthread_cond_wait(&wq->idle_cond, &wq->idle_lock);
+				wq->idle_cnt--;
+			}
+			if (wq->quit) {
+				pthread_mutex_unlock(&wq->idle_lock);
+				break;
+			}
+			pthread_mutex_unlock(&wq->idle_lock);
+			continue;
+		}
+		__atomic_fetch_sub(&wq->stat.depth, 1, __ATOMIC_RELEASE);
+
+		// cancelled while queued
+		if (!__atomic_compare_exchange_n(&job->state, &state,
+				aloe_ev_job_state_running, 0, __ATOMIC_ACQ_REL,
+				__ATOMIC_ACQUIRE)) {
+			job->r = ECANCELED;
+			wq_complete(job);
+			continue;
+		}
+		__atomic_fetch_add(&wq->stat.running, 1, __ATOMIC_RELAXED);
+		(*job->work)(job->cbarg);
+		__atomic_fetch_sub(&wq->stat.running, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&wq->stat.done, 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&job->state, aloe_ev_job_state_done, __ATOMIC_RELEASE);
+		job->r = 0;
+		wq_complete(job);
+	}
+	return NULL;
+}
+
+void* aloe_ev_wq_submit(void *_wq, void *ctx, aloe_ev_work_cb_t work,
+		aloe_ev_work_done_cb_t done, void *cbarg) {
+	wq_t *wq = (wq_t*)_wq;
+	wq_worker_t *worker;
+	aloe_ev_job_t *job;
+	unsigned long depth, depth_max;
+
+	if (!(job = malloc(sizeof(*job)))) {
+		log_e("malloc job\n");
+		return NULL;
+	}
+	job->work = work;
+	job->done = done;
+	job->cbarg = cbarg;
+	job->ctx = (aloe_ev_ctx_t*)ctx;
+	job->state = aloe_ev_job_state_queued;
+	job->r = 0;
+	job->next = NULL;
+
+	// submit from loops of multiple reactor
+	worker = &wq->worker[__atomic_fetch_add(&wq->submit_idx, 1,
+			__ATOMIC_RELAXED) % wq->worker_cnt];
+	pthread_mutex_lock(&worker->lock);
+
+	// count before visible to worker that take and decrease
+	__atomic_fetch_add(&wq->stat.submit, 1, __ATOMIC_RELAXED);
+	depth = __atomic_add_fetch(&wq->stat.depth, 1, __ATOMIC_RELEASE);
+	depth_max = __atomic_load_n(&wq->stat.depth_max, __ATOMIC_RELAXED);
+	while (depth > depth_max && !__atomic_compare_exchange_n(
+			&wq->stat.depth_max, &depth_max, depth, 1, __ATOMIC_RELAXED,
+			__ATOMIC_RELAXED));
+	TAILQ_INSERT_TAIL(&worker->job_q, job, qent);
+	pthread_mutex_unlock(&worker->lock);
+
+	pthread_mutex_lock(&wq->idle_lock);
+	if (wq->idle_cnt > 0) pthread_cond_signal(&wq->idle_cond);
+	pthread_mutex_unlock(&wq->idle_lock);
+	return (void*)job;
+}
+
+int aloe_ev_wq_cancel(void *_wq, void *_job) {
+	wq_t *wq = (wq_t*)_wq;
+	aloe_ev_job_t *job = (aloe_ev_job_t*)_job;
+	int state = aloe_ev_job_state_queued;
+
+	if (!__atomic_compare_exchange_n(&job->state, &state,
+			aloe_ev_job_state_cancel, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		return EBUSY;
+	}
+	__atomic_fetch_add(&wq->stat.cancel, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+void aloe_ev_wq_stat(void *_wq, aloe_ev_wq_stat_t *stat, int reset) {
+	wq_t *wq = (wq_t*)_wq;
+
+	if (stat) {
+		stat->depth = __atomic_load_n(&wq->stat.depth, __ATOMIC_RELAXED);
+		stat->depth_max = __atomic_load_n(&wq->stat.depth_max,
+				__ATOMIC_RELAXED);
+		stat->running = __atomic_load_n(&wq->stat.running, __ATOMIC_RELAXED);
+		stat->submit = __atomic_load_n(&wq->stat.submit, __ATOMIC_RELAXED);
+		stat->done = __atomic_load_n(&wq->stat.done, __ATOMIC_RELAXED);
+		stat->cancel = __atomic_load_n(&wq->stat.cancel, __ATOMIC_RELAXED);
+		stat->steal = __atomic_load_n(&wq->stat.steal, __ATOMIC_RELAXED);
+	}
+	if (reset) {
+		// depth and running reflect current state
+		__atomic_store_n(&wq->stat.depth_max,
+				__atomic_load_n(&wq->stat.depth, __ATOMIC_RELAXED),
+				__ATOMIC_RELAXED);
+		__atomic_store_n(&wq->stat.submit, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&wq->stat.done, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&wq->stat.cancel, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&wq->stat.steal, 0, __ATOMIC_RELAXED);
+	}
+}
+
+void aloe_ev_wq_destroy(void *_wq) {
+	wq_t *wq = (wq_t*)_wq;
+	aloe_ev_job_t *job;
+	int i;
+
+	pthread_mutex_lock(&wq->idle_lock);
+	__atomic_store_n(&wq->quit, 1, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&wq->idle_cond);
+	pthread_mutex_unlock(&wq->idle_lock);
+
+	// worker finish the job running
+	for (i = 0; i < wq->worker_cnt; i++) {
+		if (wq->worker[i].flag.started) pthread_join(wq->worker[i].thread, NULL);
+	}
+	for (i = 0; i < wq->worker_cnt; i++) {
+		wq_worker_t *worker = &wq->worker[i];
+
+		// not run, the loop call done with ECANCELED
+		while ((job = TAILQ_FIRST(&worker->job_q))) {
+			int state = aloe_ev_job_state_queued;
+
+			TAILQ_REMOVE(&worker->job_q, job, qent);
+			__atomic_fetch_sub(&wq->stat.depth, 1, __ATOMIC_RELAXED);
+			if (__atomic_compare_exchange_n(&job->state, &state,
+					aloe_ev_job_state_cancel, 0, __ATOMIC_ACQ_REL,
+					__ATOMIC_ACQUIRE)) {
+				__atomic_fetch_add(&wq->stat.cancel, 1, __ATOMIC_RELAXED);
+			}
+			job->r = ECANCELED;
+			wq_complete(job);
+		}
+		pthread_mutex_destroy(&worker->lock);
+	}
+	pthread_cond_destroy(&wq->idle_cond);
+	pthread_mutex_destroy(&wq->idle_lock);
+	free(wq->worker);
+	free(wq);
+}
+
+void* aloe_ev_wq_init(int workers) {
+	wq_t *wq;
+	int i, r;
+
+	if (workers <= 0 && (workers = (int)sysconf(_SC_NPROCESSORS_ONLN)) <= 0) {
+		workers = 1;
+	}
+	if (!(wq = calloc(1, sizeof(*wq)))) {
+		log_e("malloc worker thread pool\n");
+		return NULL;
+	}
+	if (!(wq->worker = calloc(workers, sizeof(*wq->worker)))) {
+		log_e("malloc worker\n");
+		free(wq);
+		return NULL;
+	}
+	wq->worker_cnt = workers;
+	pthread_mutex_init(&wq->idle_lock, NULL);
+	pthread_cond_init(&wq->idle_cond, NULL);
+	for (i = 0; i < workers; i++) {
+		wq_worker_t *worker = &wq->worker[i];
+
+		worker->wq = wq;
+		worker->id = i;
+		pthread_mutex_init(&worker->lock, NULL);
+		TAILQ_INIT(&worker->job_q);
+	}
+	for (i = 0; i < workers; i++) {
+		wq_worker_t *worker = &wq->worker[i];
+
+		if ((r = pthread_create(&worker->thread, NULL, &wq_worker_main,
+				worker)) != 0) {
+			log_e("Failed create worker: %s(%d)\n", strerror(r), r);
+			aloe_ev_wq_destroy(wq);
+			return NULL;
+		}
+		worker->flag.started = 1;
+	}
+	return (void*)wq;
+}
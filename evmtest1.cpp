@@ -10,19 +10,41 @@
 
 #include <time.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
 
 #define CTRL_PATH NULL
 #define CTRL_PORT CTRL_PORT_NONE
 
+/** Thread running event context. */
+typedef struct reactor_rec {
+	int id;
+	pthread_t thread;
+	int r;
+	void *ev_ctx; /**< Valid while serving, guarded by impl.mod_lock. */
+} reactor_t;
+
 static struct {
-	unsigned quit: 1;
+	int quit; /**< Accessed atomically. */
+	reactor_t *reactor;
 	int log_level;
-
-} impl = {0};
+	const char *ev_backend;
+	int prof; /**< Account callback time. */
+	unsigned long prof_slow; /**< Log callback over micro-seconds. */
+	const char *trace_path; /**< Save Chrome trace when quit. */
+	cpu_set_t cpus; /**< Where reactor pinned. */
+	pthread_mutex_t mod_lock; /**< Serialize module init. */
+	pthread_cond_t ready_cond; /**< Reactor wait all initialized. */
+	int ready_cnt, init_err;
+} impl;
 
 extern "C" {
 
-void *ev_ctx = NULL, *cfg_ctx = NULL;
+void *cfg_ctx = NULL;
+__thread void *ev_ctx = NULL;
+__thread int reactor_id = 0;
+int reactor_cnt = 1;
 const char *ctrl_path = CTRL_PATH;
 int ctrl_port = CTRL_PORT;
 
@@ -136,9 +158,11 @@ int log_printf(const char *lvl, const char *func_name, int lno,
 	return fb.lmt;
 }
 
-static const char opt_short[] = "ht:v";
+static const char opt_short[] = "ht:vb:j:";
 enum {
 	opt_key_reflags = 0x201,
+	opt_key_prof,
+	opt_key_trace,
 	opt_key_max
 };
 static struct option opt_long[] = {
@@ -146,7 +170,11 @@ static struct option opt_long[] = {
 	{"ctrlpath", required_argument, NULL, 't'},
 	{"ctrlport", required_argument, NULL, 'p'},
 	{"verbose", no_argument, NULL, 'v'},
+	{"backend", required_argument, NULL, 'b'},
+	{"reactors", required_argument, NULL, 'j'},
 	{"reflags", required_argument, NULL, opt_key_reflags},
+	{"prof", optional_argument, NULL, opt_key_prof},
+	{"trace", required_argument, NULL, opt_key_trace},
 	{0},
 };
 
@@ -176,6 +204,12 @@ static void help(int argc, char **argv) {
 #endif
 "\n"
 "    -v, --verbose      Verbose output (default mimic debug and more)\n"
+"    -b, --backend=<NAME>\n"
+"                       Event backend, epoll or select(first workable)\n"
+"    -j, --reactors=<N> Event loop threads pinned to core, 0 for each core(1)\n"
+"    --prof[=<US>]      Account callback time, dump when quit, and log\n"
+"                       callback took more than US micro-seconds\n"
+"    --trace=<PATH>     Trace loop, save Chrome trace event JSON when quit\n"
 "\n",
 		((argc > 0) && argv && argv[0] ? argv[0] : "Program"),
 		(CTRL_PATH ? CTRL_PATH : "")
@@ -185,9 +219,50 @@ static void help(int argc, char **argv) {
 		);
 }
 
-int main(int argc, char **argv) {
-	int opt_op, opt_idx, r, opt_exit = 0;
-	aloe_buf_t buf = {.data = NULL};
+static void reactor_on_quit(void *cbarg) {
+	(void)cbarg;
+}
+
+/** Ask all reactors quit, wakeup those blocked in wait. */
+static void reactor_quit(void) {
+	int i;
+
+	__atomic_store_n(&impl.quit, 1, __ATOMIC_RELEASE);
+	pthread_mutex_lock(&impl.mod_lock);
+	for (i = 0; impl.reactor && i < reactor_cnt; i++) {
+		reactor_t *reactor = &impl.reactor[i];
+
+		if (reactor->ev_ctx) {
+			aloe_ev_post(reactor->ev_ctx, &reactor_on_quit, NULL);
+		}
+	}
+	pthread_mutex_unlock(&impl.mod_lock);
+}
+
+/** Pin reactor to the id-th core allowed. */
+static int reactor_pin(reactor_t *reactor) {
+	int cpu_cnt = CPU_COUNT(&impl.cpus), i, r;
+	cpu_set_t cpus;
+
+	if (cpu_cnt < 1) return 0;
+	for (i = 0, r = reactor->id % cpu_cnt; i < CPU_SETSIZE; i++) {
+		if (CPU_ISSET(i, &impl.cpus) && r-- <= 0) break;
+	}
+	if (i >= CPU_SETSIZE) return 0;
+	CPU_ZERO(&cpus);
+	CPU_SET(i, &cpus);
+	if ((r = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) != 0) {
+		log_e("Failed pin reactor[%d] to cpu %d: %s(%d)\n", reactor->id, i,
+				strerror(r), r);
+		return r;
+	}
+	log_d("reactor[%d] pinned to cpu %d\n", reactor->id, i);
+	return 0;
+}
+
+static void* reactor_main(void *_reactor) {
+	reactor_t *reactor = (reactor_t*)_reactor;
+	aloe_ev_cfg_t ev_cfg = {.backend = impl.ev_backend};
 	typedef struct mod_rec {
 		const aloe_mod_t *op;
 		TAILQ_ENTRY(mod_rec) qent;
@@ -195,6 +270,98 @@ int main(int argc, char **argv) {
 	} mod_t;
 	TAILQ_HEAD(mod_queue_rec, mod_rec) mod_q = TAILQ_HEAD_INITIALIZER(mod_q);
 	mod_t *mod;
+	int r;
+
+	reactor_id = reactor->id;
+	if (reactor_cnt > 1) reactor_pin(reactor);
+	ev_cfg.prof = impl.prof;
+	ev_cfg.prof_slow_us = impl.prof_slow;
+	if (impl.trace_path) aloe_ev_trace_start(1ul << 16);
+
+	if (!(ev_ctx = aloe_ev_init2(&ev_cfg))) {
+		r = ENOMEM;
+		log_e("aloe_ev_init\n");
+		goto ready;
+	}
+	log_d("reactor[%d] event backend: %s\n", reactor->id,
+			aloe_ev_backend(ev_ctx));
+
+	// module instance per reactor, init serialized for shared config
+	pthread_mutex_lock(&impl.mod_lock);
+#define MOD_INIT(_op) { \
+		extern const aloe_mod_t _op; \
+		if (!(mod = (mod_t*)malloc(sizeof(*mod)))) { \
+			r = ENOMEM; \
+			log_e("alloc mod: %s\n", _op.name); \
+			goto mod_ready; \
+		} \
+		mod->op = &_op; \
+		ALOE_EV_TRACE(aloe_ev_trace_mod, _op.name, 0); \
+		mod->ctx = (*mod->op->init)(); \
+		ALOE_EV_TRACE(aloe_ev_trace_mod_end, _op.name, 0); \
+		if (!mod->ctx) { \
+			free(mod); \
+			r = EIO; \
+			log_e("init mod: %s\n", _op.name); \
+			goto mod_ready; \
+		} \
+		TAILQ_INSERT_TAIL(&mod_q, mod, qent); \
+	}
+	MOD_INIT(mod_cli);
+#ifdef WITH_ALSA
+	MOD_INIT(mod_micloop);
+#endif
+
+#if 0
+	MOD_INIT(mod_test1_buf1);
+	__atomic_store_n(&impl.quit, 1, __ATOMIC_RELEASE);
+#endif
+	r = 0;
+mod_ready:
+	pthread_mutex_unlock(&impl.mod_lock);
+ready:
+	// serve after all reactors ready
+	pthread_mutex_lock(&impl.mod_lock);
+	if (r != 0) impl.init_err = r;
+	impl.ready_cnt++;
+	pthread_cond_broadcast(&impl.ready_cond);
+	while (!impl.init_err && impl.ready_cnt < reactor_cnt) {
+		pthread_cond_wait(&impl.ready_cond, &impl.mod_lock);
+	}
+	if (impl.init_err && r == 0) r = ECANCELED;
+	if (r == 0) reactor->ev_ctx = ev_ctx;
+	pthread_mutex_unlock(&impl.mod_lock);
+	if (r != 0) goto finally;
+
+    while (!__atomic_load_n(&impl.quit, __ATOMIC_ACQUIRE)) {
+    	aloe_ev_once(ev_ctx);
+//    	log_d("enter\n");
+    }
+	r = 0;
+finally:
+	pthread_mutex_lock(&impl.mod_lock);
+	reactor->ev_ctx = NULL;
+	pthread_mutex_unlock(&impl.mod_lock);
+	while ((mod = TAILQ_LAST(&mod_q, mod_queue_rec))) {
+		TAILQ_REMOVE(&mod_q, mod, qent);
+		mod->op->destroy(mod->ctx);
+		free(mod);
+	}
+	if (ev_ctx) {
+		if (impl.prof) aloe_ev_prof_dump(ev_ctx, 0);
+		aloe_ev_destroy(ev_ctx);
+		ev_ctx = NULL;
+	}
+	aloe_buf_pool_clean();
+	aloe_ev_trace_stop();
+	reactor->r = r;
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	int opt_op, opt_idx, r, i, started, opt_exit = 0;
+	aloe_buf_t buf = {.data = NULL};
+	reactor_t *reactor = NULL;
 
 	impl.log_level = log_level_info;
 	optind = 0;
@@ -216,6 +383,23 @@ int main(int argc, char **argv) {
 			if (impl.log_level < log_level_verb) impl.log_level++;
 			continue;
 		}
+		if (opt_op == 'b') {
+			impl.ev_backend = optarg;
+			continue;
+		}
+		if (opt_op == 'j') {
+			reactor_cnt = strtol(optarg, NULL, 10);
+			continue;
+		}
+		if (opt_op == opt_key_trace) {
+			impl.trace_path = optarg;
+			continue;
+		}
+		if (opt_op == opt_key_prof) {
+			impl.prof = 1;
+			if (optarg) impl.prof_slow = strtoul(optarg, NULL, 10);
+			continue;
+		}
 	}
 
 	if (!ctrl_path || !ctrl_path[0]) ctrl_path = CTRL_PATH;
@@ -228,50 +412,64 @@ int main(int argc, char **argv) {
 		goto finally;
 	}
 
+	CPU_ZERO(&impl.cpus);
+	if (sched_getaffinity(0, sizeof(impl.cpus), &impl.cpus) != 0) {
+		r = errno;
+		log_e("Failed get cpu affinity: %s(%d)\n", strerror(r), r);
+		CPU_ZERO(&impl.cpus);
+	}
+	if (reactor_cnt <= 0) reactor_cnt = CPU_COUNT(&impl.cpus);
+	if (reactor_cnt <= 0) reactor_cnt = 1;
+	log_d("reactors: %d\n", reactor_cnt);
+
 	if (!(cfg_ctx = aloe_cfg_init())) {
 		r = ENOMEM;
 		log_e("aloe_cfg_init\n");
 		goto finally;
 	}
 
-	if (!(ev_ctx = aloe_ev_init())) {
+	if (!(reactor = (reactor_t*)calloc(reactor_cnt, sizeof(*reactor)))) {
 		r = ENOMEM;
-		log_e("aloe_ev_init\n");
+		log_e("alloc reactors\n");
 		goto finally;
 	}
-
-#define MOD_INIT(_op) { \
-		extern const aloe_mod_t _op; \
-		static mod_t mod = {&_op}; \
-		if (!(mod.ctx = (*mod.op->init)())) { \
-			r = EIO; \
-			log_e("init mod: %s\n", mod.op->name); \
-			goto finally; \
-		} \
-		TAILQ_INSERT_TAIL(&mod_q, &mod, qent); \
+	pthread_mutex_init(&impl.mod_lock, NULL);
+	pthread_cond_init(&impl.ready_cond, NULL);
+	impl.reactor = reactor;
+
+	// first reactor run in main thread
+	for (i = 1; i < reactor_cnt; i++) {
+		reactor[i].id = i;
+		if ((r = pthread_create(&reactor[i].thread, NULL, &reactor_main,
+				&reactor[i])) != 0) {
+			log_e("Failed start reactor[%d]: %s(%d)\n", i, strerror(r), r);
+			pthread_mutex_lock(&impl.mod_lock);
+			impl.init_err = r;
+			pthread_cond_broadcast(&impl.ready_cond);
+			pthread_mutex_unlock(&impl.mod_lock);
+			break;
+		}
 	}
-	MOD_INIT(mod_cli);
-#ifdef WITH_ALSA
-	MOD_INIT(mod_micloop);
-#endif
-
-#if 0
-	MOD_INIT(mod_test1_buf1);
-	impl.quit = 1;
-#endif
-    while (!impl.quit) {
-    	aloe_ev_once(ev_ctx);
-//    	log_d("enter\n");
-    }
-	r = 0;
-finally:
-	while ((mod = TAILQ_LAST(&mod_q, mod_queue_rec))) {
-		TAILQ_REMOVE(&mod_q, mod, qent);
-		mod->op->destroy(mod->ctx);
+	started = i;
+	if (started >= reactor_cnt) {
+		reactor_main(&reactor[0]);
+		r = reactor[0].r;
 	}
-	if (ev_ctx) {
-		aloe_ev_destroy(ev_ctx);
+	// rest reactors go with the first
+	reactor_quit();
+	for (i = 1; i < started; i++) {
+		pthread_join(reactor[i].thread, NULL);
+		if (r == 0) r = reactor[i].r;
+	}
+	impl.reactor = NULL;
+	pthread_cond_destroy(&impl.ready_cond);
+	pthread_mutex_destroy(&impl.mod_lock);
+	if (impl.trace_path) {
+		aloe_ev_trace_save(impl.trace_path);
+		aloe_ev_trace_clear();
 	}
+finally:
+	if (reactor) free(reactor);
 	if (cfg_ctx) {
 		aloe_cfg_destroy(cfg_ctx);
 	}
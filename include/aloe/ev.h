@@ -5,6 +5,10 @@
 #ifndef _H_ALOE_EV
 #define _H_ALOE_EV
 
+#include <stddef.h>
+#include <time.h>
+#include <sys/socket.h>
+
 /** @defgroup ALOE_EV_API Event driven API
  * @brief Event driven API.
  */
@@ -23,6 +27,15 @@ typedef enum aloe_ev_flag_enum {
 	aloe_ev_flag_write = (1 << 1), /**< Writable. */
 	aloe_ev_flag_except = (1 << 2),/**< Exception. */
 	aloe_ev_flag_time = (1 << 3), /**< Timeout. */
+	aloe_ev_flag_persist = (1 << 4), /**< Keep waiting after notified until cancel. */
+	/**
+	 * Notify when FD become ready instead of while it is ready, applied to
+	 * all waiting on the FD.
+	 *
+	 * Use with aloe_ev_flag_persist and drain the FD until EAGAIN. Backend
+	 * without edge trigger (select) fallback to level trigger.
+	 */
+	aloe_ev_flag_edge = (1 << 5),
 } aloe_ev_flag_t;
 
 /** Indicate no timeout. */
@@ -31,24 +44,342 @@ typedef enum aloe_ev_flag_enum {
 /** Callback for notify event to user. */
 typedef void (*aloe_ev_noti_cb_t)(int fd, unsigned ev_noti, void *cbarg);
 
-/** Put the event into internal process. */
+/** Put the event into internal process.
+ *
+ * With aloe_ev_flag_persist, the timeout restart from each notify.
+ */
 void* aloe_ev_put(void *ctx, int fd, aloe_ev_noti_cb_t cb, void *cbarg,
 		unsigned ev_wait, unsigned long sec, unsigned long usec);
 
 void* aloe_ev_get(void *ctx, int fd, aloe_ev_noti_cb_t cb);
 
+/** How periodic timer handle tick missed, ie. callback took too long. */
+typedef enum aloe_ev_periodic_enum {
+	aloe_ev_periodic_catchup = 0, /**< Notify missed tick back to back. */
+	aloe_ev_periodic_skip, /**< Drop missed tick, resume at next on grid. */
+} aloe_ev_periodic_t;
+
+/** Put timer notify every period on the grid from first due.
+ *
+ * Unlike persistent timeout, the due advance from the previous due instead
+ * of time callback returned, not drift with latency of loop.  Remove with
+ * aloe_ev_cancel().
+ */
+void* aloe_ev_put_periodic(void *ctx, aloe_ev_noti_cb_t cb, void *cbarg,
+		unsigned long sec, unsigned long usec, aloe_ev_periodic_t policy);
+
+/** Priority to dispatch notify ready in the same loop. */
+typedef enum aloe_ev_prio_enum {
+	aloe_ev_prio_rt = 0, /**< Real-time, always dispatch regardless budget. */
+	aloe_ev_prio_normal, /**< Default. */
+	aloe_ev_prio_bg, /**< Background, dispatch after all others. */
+} aloe_ev_prio_t;
+
+/** Count of priority. */
+#define ALOE_EV_PRIO_CNT 3
+
+/** Change priority of the event, default aloe_ev_prio_normal. */
+int aloe_ev_prio(void *ctx, void *ev, aloe_ev_prio_t prio);
+
+/** Run once in next loop, without waiting IO or timeout.
+ *
+ * Callback with fd -1 and ev_noti 0, remove with aloe_ev_cancel().  Work
+ * coalesced here dispatched with the ready notify in priority normal.
+ */
+void* aloe_ev_defer(void *ctx, aloe_ev_noti_cb_t cb, void *cbarg);
+
+/** Run once when loop have nothing to dispatch.
+ *
+ * Loop poll IO instead of blocking while idle callback pending, and run
+ * them only when no IO ready and no timeout.  Put again in callback to
+ * run again when idle next time.
+ */
+void* aloe_ev_idle(void *ctx, aloe_ev_noti_cb_t cb, void *cbarg);
+
 /** Remove the event from internal process. */
 void aloe_ev_cancel(void *ctx, void *ev);
 
-/** Process a loop. */
+/** Process a loop, 0 or errno. */
 int aloe_ev_once(void *ctx);
 
+/** Monotonic time cached when the loop wakeup.
+ *
+ * Timeout put from callback count from this time, which stale by the time
+ * callbacks before took.  Refresh with aloe_ev_now_update() after long
+ * blocking outside the loop, or set aloe_ev_cfg_t::precise.  The wait for
+ * timer due read the clock again before sleep.
+ */
+const struct timespec* aloe_ev_now(void *ctx);
+
+/** Refresh time cached for the loop, return 0 or errno. */
+int aloe_ev_now_update(void *ctx);
+
+/** Callback for task posted to the loop. */
+typedef void (*aloe_ev_post_cb_t)(void *cbarg);
+
+/** Run the task in the loop, safe to call from any thread.
+ *
+ * Tasks posted before the loop wakeup run in a batch, in order of posting.
+ *
+ * @return 0 when posted, otherwise errno.
+ */
+int aloe_ev_post(void *ctx, aloe_ev_post_cb_t cb, void *cbarg);
+
+/** Callback for completion of asynchronous IO.
+ *
+ * @param fd The FD to perform IO.
+ * @param res Result as the system call, or negative errno.
+ */
+typedef void (*aloe_ev_io_cb_t)(int fd, long res, void *cbarg);
+
+/** Read asynchronously, off -1 for current file position.
+ *
+ * Complete with io_uring when available, otherwise read when readable.  The
+ * buffer must be valid until completion.
+ *
+ * @return 0 when submitted, otherwise errno.
+ */
+int aloe_ev_io_read(void *ctx, int fd, void *buf, size_t len, long off,
+		aloe_ev_io_cb_t cb, void *cbarg);
+
+/** Write asynchronously, off -1 for current file position. */
+int aloe_ev_io_write(void *ctx, int fd, const void *buf, size_t len, long off,
+		aloe_ev_io_cb_t cb, void *cbarg);
+
+/** Accept asynchronously, complete with the FD accepted. */
+int aloe_ev_io_accept(void *ctx, int fd, struct sockaddr *sa,
+		socklen_t *sa_len, aloe_ev_io_cb_t cb, void *cbarg);
+
+/** Receive asynchronously. */
+int aloe_ev_io_recv(void *ctx, int fd, void *buf, size_t len, int flags,
+		aloe_ev_io_cb_t cb, void *cbarg);
+
+/** Send asynchronously. */
+int aloe_ev_io_send(void *ctx, int fd, const void *buf, size_t len, int flags,
+		aloe_ev_io_cb_t cb, void *cbarg);
+
+/** Name of asynchronous IO in use, "io_uring" or "readiness". */
+const char* aloe_ev_io_engine(void *ctx);
+
+/** Job to run in worker thread. */
+typedef void (*aloe_ev_work_cb_t)(void *cbarg);
+
+/** Job done, called in the loop submitted the job.
+ *
+ * @param r 0 when the job run, ECANCELED when cancelled before run.
+ */
+typedef void (*aloe_ev_work_done_cb_t)(int r, void *cbarg);
+
+/** Start worker thread pool, workers 0 for one per CPU online. */
+void* aloe_ev_wq_init(int workers);
+
+/** Run the job in worker, then done in the loop of ctx.
+ *
+ * Completions to the same context delivered in batch.  The job valid until
+ * done called.
+ *
+ * @return The job to cancel, NULL when failed.
+ */
+void* aloe_ev_wq_submit(void *wq, void *ctx, aloe_ev_work_cb_t work,
+		aloe_ev_work_done_cb_t done, void *cbarg);
+
+/** Cancel the job not running yet, done called later with ECANCELED.
+ *
+ * @return 0 when cancelled, EBUSY when running or finished.
+ */
+int aloe_ev_wq_cancel(void *wq, void *job);
+
+/** Worker thread pool statistics. */
+typedef struct aloe_ev_wq_stat_rec {
+	/**
+	 * Job waiting in queue, include cancelled till worker take it to
+	 * deliver ECANCELED.
+	 */
+	unsigned long depth;
+	unsigned long depth_max; /**< Maximal depth. */
+	unsigned long running; /**< Job running in worker. */
+	unsigned long submit; /**< Count of job submitted. */
+	unsigned long done; /**< Count of job run. */
+	unsigned long cancel; /**< Count of job cancelled. */
+	unsigned long steal; /**< Count of job run by other worker. */
+} aloe_ev_wq_stat_t;
+
+/** Get statistics, and restart counting when reset. */
+void aloe_ev_wq_stat(void *wq, aloe_ev_wq_stat_t *stat, int reset);
+
+/** Stop worker after the job running, done with ECANCELED for job not run.
+ *
+ * Destroy the pool before the context job submitted to, the done delivered
+ * when the loop run again.
+ */
+void aloe_ev_wq_destroy(void *wq);
+
+/** Option to initialize context. */
+typedef struct aloe_ev_cfg_rec {
+	/** Backend name, "epoll" or "select", NULL for first workable. */
+	const char *backend;
+
+	/** Asynchronous IO, "io_uring" or "readiness", NULL for first workable. */
+	const char *io_engine;
+
+	/** Honor timeout in nano-seconds, without the floor to prevent busy loop. */
+	int hires;
+
+	/** Read the clock to put and rearm timeout instead of loop time cached. */
+	int precise;
+
+	/**
+	 * Timer slack in nano-seconds for the calling thread, 0 to keep default.
+	 *
+	 * Kernel may delay wakeup up to the slack to coalesce timers.
+	 */
+	unsigned long tmr_slack;
+
+	/** FD and notify record to allocate at init. */
+	unsigned long pool_prealloc;
+
+	/**
+	 * Return memory to system when spare record more than this, 0 to keep.
+	 *
+	 * The notify must not be cancelled again after notified or cancelled,
+	 * that the memory might be gone.
+	 */
+	unsigned long pool_spare_max;
+
+	/**
+	 * Callback to dispatch in a loop, 0 for unlimited.
+	 *
+	 * Notify over the budget wait for next loop, except aloe_ev_prio_rt.
+	 */
+	unsigned long budget_cb;
+
+	/** Time in micro-seconds to dispatch in a loop, 0 for unlimited. */
+	unsigned long budget_us;
+
+	/**
+	 * Maximal time in micro-seconds to poll IO before sleep, 0 to disable.
+	 *
+	 * Trade CPU for latency to wakeup.  The time spin adapt to average
+	 * interval between IO, no spin when IO come apart more than this.
+	 */
+	unsigned long spin_us;
+
+	/** Account time per callback, see aloe_ev_prof_get(). */
+	int prof;
+
+	/** Log callback took more than micro-seconds, 0 to disable. */
+	unsigned long prof_slow_us;
+} aloe_ev_cfg_t;
+
 /** Initialize context. */
 void* aloe_ev_init(void);
 
+/** Initialize context with option, NULL cfg to use default. */
+void* aloe_ev_init2(const aloe_ev_cfg_t *cfg);
+
+/** Name of backend in use. */
+const char* aloe_ev_backend(void *ctx);
+
+/** Timer overshoot, lateness from due to dispatch. */
+typedef struct aloe_ev_tmr_stat_rec {
+	unsigned long cnt; /**< Count of timeout dispatched. */
+	unsigned long sum; /**< Sum of overshoot in nano-seconds. */
+	unsigned long max; /**< Maximal overshoot in nano-seconds. */
+	/** Count of overshoot below 1us, 10us, 100us, 1ms, 10ms and above. */
+	unsigned long hist[6];
+} aloe_ev_tmr_stat_t;
+
+/** Get timer overshoot, and restart counting when reset. */
+void aloe_ev_tmr_stat(void *ctx, aloe_ev_tmr_stat_t *stat, int reset);
+
+/** Busy poll before sleep. */
+typedef struct aloe_ev_spin_stat_rec {
+	unsigned long spin; /**< Count of loop spin. */
+	unsigned long hit; /**< Count of IO ready while spin, without sleep. */
+	unsigned long ns; /**< Time spin in nano-seconds. */
+	unsigned long budget_ns; /**< Time to spin for now. */
+	unsigned long gap_ns; /**< Average interval between IO. */
+} aloe_ev_spin_stat_t;
+
+/** Get busy poll statistics, and restart counting when reset. */
+void aloe_ev_spin_stat(void *ctx, aloe_ev_spin_stat_t *stat, int reset);
+
+/** Time accounted per callback. */
+typedef struct aloe_ev_prof_stat_rec {
+	aloe_ev_noti_cb_t cb; /**< NULL for callback over the slot. */
+	const char *name; /**< Set by aloe_ev_prof_name(), or NULL. */
+	unsigned long cnt; /**< Count of call. */
+	unsigned long wall_ns; /**< Sum of monotonic time. */
+	unsigned long cpu_ns; /**< Sum of thread CPU time. */
+	unsigned long max_ns; /**< Maximal monotonic time. */
+	unsigned long slow; /**< Count of call over prof_slow_us. */
+} aloe_ev_prof_stat_t;
+
+/** Name the callback in statistics and log. */
+int aloe_ev_prof_name(void *ctx, aloe_ev_noti_cb_t cb, const char *name);
+
+/** Get statistics up to cnt callback, safe to call from any thread.
+ *
+ * @return Count of callback filled.
+ */
+int aloe_ev_prof_get(void *ctx, aloe_ev_prof_stat_t *stat, int cnt,
+		int reset);
+
+/** Log statistics in order of time spent. */
+void aloe_ev_prof_dump(void *ctx, int reset);
+
+/** Memory usage for the records. */
+typedef struct aloe_ev_pool_stat_rec {
+	unsigned long used; /**< Record in use. */
+	unsigned long spare; /**< Record ready to reuse. */
+	unsigned long slab; /**< Slab in pool. */
+	unsigned long slab_alloc; /**< Count of slab allocated. */
+	unsigned long slab_free; /**< Count of slab returned to system. */
+} aloe_ev_pool_stat_t;
+
+/** Get memory usage for FD and notify records, NULL to skip. */
+void aloe_ev_pool_stat(void *ctx, aloe_ev_pool_stat_t *fd,
+		aloe_ev_pool_stat_t *noti);
+
 /** Free context. */
 void aloe_ev_destroy(void *ctx);
 
+/** Record in trace. */
+typedef enum aloe_ev_trace_enum {
+	aloe_ev_trace_wait = 0, /**< Loop wait, arg timeout in us or -1. */
+	aloe_ev_trace_wakeup, /**< Loop wakeup. */
+	aloe_ev_trace_cb, /**< Callback begin, ptr callback, arg fd. */
+	aloe_ev_trace_cb_end, /**< Callback end. */
+	aloe_ev_trace_tmr, /**< Timer fire, ptr callback. */
+	aloe_ev_trace_mod, /**< Module init begin, ptr name. */
+	aloe_ev_trace_mod_end, /**< Module end. */
+} aloe_ev_trace_t;
+
+/** Tracing in this thread, test by ALOE_EV_TRACE(). */
+extern __thread int aloe_ev_trace_on;
+
+/** Append record to trace of this thread. */
+void aloe_ev_trace_rec(aloe_ev_trace_t type, const void *ptr, long arg);
+
+/** Record when tracing, a branch when not. */
+#define ALOE_EV_TRACE(_type, _ptr, _arg) do { \
+	if (__builtin_expect(aloe_ev_trace_on, 0)) { \
+		aloe_ev_trace_rec(_type, _ptr, _arg); \
+	} \
+} while(0)
+
+/** Start tracing this thread, keep the latest rec_cnt record. */
+int aloe_ev_trace_start(unsigned long rec_cnt);
+
+/** Stop tracing this thread, record kept to save. */
+void aloe_ev_trace_stop(void);
+
+/** Convert record of all thread to Chrome trace event JSON. */
+int aloe_ev_trace_save(const char *path);
+
+/** Release record of thread stopped tracing. */
+void aloe_ev_trace_clear(void);
+
 /** @} ALOE_EV_API */
 
 #ifdef __cplusplus
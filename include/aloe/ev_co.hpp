@@ -0,0 +1,387 @@
+/**
+ * @author joelai
+ */
+
+#ifndef _H_ALOE_EV_CO
+#define _H_ALOE_EV_CO
+
+#if __cplusplus < 202002L
+#  error "aloe/ev_co.hpp require C++20"
+#endif
+
+#include <aloe/ev.h>
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <optional>
+#include <utility>
+
+/** @defgroup ALOE_EV_CO Coroutine over event driven API
+ * @brief C++20 coroutine to wait event in line instead of callback chain.
+ *
+ * Coroutine resumed by the loop in the thread running the event context,
+ * the frame must not be moved across thread.
+ *
+ * @code
+ * aloe::ev::task<> session(int fd) {
+ *   char buf[128];
+ *   while (co_await aloe::ev::readable(fd, 30) & aloe_ev_flag_read) {
+ *     ssize_t len = read(fd, buf, sizeof(buf));
+ *     if (len <= 0) break;
+ *     co_await aloe::ev::writable(fd);
+ *     write(fd, buf, len);
+ *   }
+ *   close(fd);
+ * }
+ *
+ * aloe::ev::spawn(ev_ctx, session(fd));
+ * @endcode
+ */
+
+namespace aloe {
+namespace ev {
+
+/** @addtogroup ALOE_EV_CO
+ * @{
+ */
+
+/** Pool of coroutine frame, free list per size class in this thread. */
+class frame_pool {
+public:
+	/** Smallest class, frame in 64 bytes step up to kMax. */
+	static constexpr std::size_t kMin = 64;
+
+	/** Larger frame go to global new. */
+	static constexpr std::size_t kMax = 4096;
+
+	/** Bytes kept per size class, at least kKeepMin frame. */
+	static constexpr std::size_t kKeep = 256 << 10;
+	static constexpr std::size_t kKeepMin = 4;
+
+	static void* alloc(std::size_t sz) {
+		int cls = size_class(sz);
+		spare_t &spare = spare_get();
+		link_t *link;
+
+		if (cls < 0) return ::operator new(sz);
+		if ((link = spare.q[cls])) {
+			spare.q[cls] = link->next;
+			spare.cnt[cls]--;
+			return (void*)link;
+		}
+		return ::operator new((std::size_t)(cls + 1) * kMin);
+	}
+
+	static void free(void *p, std::size_t sz) noexcept {
+		int cls = size_class(sz);
+		spare_t &spare = spare_get();
+		link_t *link = (link_t*)p;
+
+		// beyond the keep limit go back to global delete
+		if (cls < 0 || (spare.cnt[cls] >= kKeepMin && (spare.cnt[cls] + 1)
+				* (std::size_t)(cls + 1) * kMin > kKeep)) {
+			::operator delete(p);
+			return;
+		}
+		link->next = spare.q[cls];
+		spare.q[cls] = link;
+		spare.cnt[cls]++;
+	}
+
+private:
+	struct link_t {
+		link_t *next;
+	};
+
+	static constexpr int kClass = (int)(kMax / kMin);
+
+	static int size_class(std::size_t sz) {
+		return sz > kMax ? -1 : (int)((sz + kMin - 1) / kMin) - 1;
+	}
+
+	/** Frame kept for reuse, released with the thread. */
+	struct spare_t {
+		link_t *q[kClass] = {};
+		std::size_t cnt[kClass] = {}; /**< Frame in q. */
+
+		~spare_t() {
+			for (int i = 0; i < kClass; i++) {
+				while (link_t *link = q[i]) {
+					q[i] = link->next;
+					::operator delete((void*)link);
+				}
+			}
+		}
+	};
+
+	static spare_t& spare_get() {
+		static thread_local spare_t spare;
+		return spare;
+	}
+};
+
+/** Event context for awaitable without context given. */
+inline void*& current() {
+	static thread_local void *ctx = nullptr;
+	return ctx;
+}
+
+template <typename T = void>
+class task;
+
+namespace detail {
+
+/** Promise common to task of any result. */
+struct promise_base {
+	std::coroutine_handle<> cont; /**< Coroutine awaiting this task. */
+	bool detached = false; /**< Spawned, release the frame when done. */
+
+	static void* operator new(std::size_t sz) {
+		return frame_pool::alloc(sz);
+	}
+
+	static void operator delete(void *p, std::size_t sz) noexcept {
+		frame_pool::free(p, sz);
+	}
+
+	std::suspend_always initial_suspend() noexcept {
+		return {};
+	}
+
+	/** Resume the awaiting coroutine, or release detached frame. */
+	struct final_awaiter {
+		bool await_ready() noexcept {
+			return false;
+		}
+
+		template <typename P>
+		std::coroutine_handle<> await_suspend(
+				std::coroutine_handle<P> h) noexcept {
+			promise_base &p = h.promise();
+
+			if (p.cont) return p.cont;
+			if (p.detached) h.destroy();
+			return std::noop_coroutine();
+		}
+
+		void await_resume() noexcept {}
+	};
+
+	final_awaiter final_suspend() noexcept {
+		return {};
+	}
+
+	/** Error in detached task have nowhere to report. */
+	void unhandled_exception() noexcept {
+		if (detached) std::terminate();
+		err = std::current_exception();
+	}
+
+	std::exception_ptr err;
+};
+
+template <typename T>
+struct promise: promise_base {
+	/** Result, T not required to be default constructible. */
+	std::optional<T> val;
+
+	task<T> get_return_object() noexcept;
+
+	void return_value(T v) {
+		val.emplace(std::move(v));
+	}
+
+	T result() {
+		if (err) std::rethrow_exception(err);
+		return std::move(*val);
+	}
+};
+
+template <>
+struct promise<void>: promise_base {
+	task<void> get_return_object() noexcept;
+
+	void return_void() noexcept {}
+
+	void result() {
+		if (err) std::rethrow_exception(err);
+	}
+};
+
+} // namespace detail
+
+/**
+ * Coroutine start when awaited or spawned.
+ *
+ * Awaiting run the task in line and take the result.
+ */
+template <typename T>
+class task {
+public:
+	using promise_type = detail::promise<T>;
+	using handle_t = std::coroutine_handle<promise_type>;
+
+	explicit task(handle_t h) noexcept: h(h) {}
+
+	task(task &&o) noexcept: h(std::exchange(o.h, nullptr)) {}
+
+	task(const task&) = delete;
+	task& operator=(const task&) = delete;
+
+	~task() {
+		if (h) h.destroy();
+	}
+
+	bool await_ready() const noexcept {
+		return !h || h.done();
+	}
+
+	std::coroutine_handle<> await_suspend(
+			std::coroutine_handle<> caller) noexcept {
+		h.promise().cont = caller;
+		return h;
+	}
+
+	T await_resume() {
+		return h.promise().result();
+	}
+
+	/** Give up the frame, released when the coroutine done. */
+	handle_t release() noexcept {
+		return std::exchange(h, nullptr);
+	}
+
+private:
+	handle_t h;
+};
+
+namespace detail {
+
+template <typename T>
+inline task<T> promise<T>::get_return_object() noexcept {
+	return task<T>{task<T>::handle_t::from_promise(*this)};
+}
+
+inline task<void> promise<void>::get_return_object() noexcept {
+	return task<void>{task<void>::handle_t::from_promise(*this)};
+}
+
+} // namespace detail
+
+/**
+ * Run the task in the event context till first wait, then by the loop.
+ *
+ * The frame released when the task done.
+ */
+template <typename T>
+inline void spawn(void *ctx, task<T> &&t) {
+	typename task<T>::handle_t h = t.release();
+	void *prev = std::exchange(current(), ctx);
+
+	h.promise().detached = true;
+	h.resume();
+	current() = prev;
+}
+
+/** Wait event by aloe_ev_put(), result as ev_noti of the callback. */
+class ev_awaiter {
+public:
+	ev_awaiter(void *ctx, int fd, unsigned ev_wait, unsigned long sec,
+			unsigned long usec) noexcept: ctx(ctx), fd(fd), ev_wait(ev_wait),
+			sec(sec), usec(usec) {}
+
+	ev_awaiter(const ev_awaiter&) = delete;
+	ev_awaiter& operator=(const ev_awaiter&) = delete;
+
+	/** Task destroyed while suspended, cancel the pending wait. */
+	~ev_awaiter() {
+		if (ev) aloe_ev_cancel(ctx, ev);
+	}
+
+	bool await_ready() const noexcept {
+		return false;
+	}
+
+	/** Not suspend when failed to put, result 0. */
+	bool await_suspend(std::coroutine_handle<> h) noexcept {
+		this->h = h;
+		ev = aloe_ev_put(ctx, fd, &on_noti, this, ev_wait, sec, usec);
+		return ev != nullptr;
+	}
+
+	unsigned await_resume() const noexcept {
+		return ev_noti;
+	}
+
+private:
+	static void on_noti(int, unsigned ev_noti, void *cbarg) {
+		ev_awaiter *aw = (ev_awaiter*)cbarg;
+		void *prev = std::exchange(current(), aw->ctx);
+
+		// released after callback, the frame may go away in resume()
+		aw->ev = nullptr;
+		aw->ev_noti = ev_noti;
+		aw->h.resume();
+		current() = prev;
+	}
+
+	void *ctx;
+	int fd;
+	unsigned ev_wait;
+	unsigned long sec, usec;
+	unsigned ev_noti = 0;
+	void *ev = nullptr; /**< Pending aloe_ev_put(), null after callback. */
+	std::coroutine_handle<> h;
+};
+
+/** Wait readable, or aloe_ev_flag_time when timeout in sec and usec. */
+inline ev_awaiter readable(void *ctx, int fd,
+		unsigned long sec = ALOE_EV_INFINITE, unsigned long usec = 0) {
+	return ev_awaiter(ctx, fd, aloe_ev_flag_read, sec, usec);
+}
+
+inline ev_awaiter readable(int fd, unsigned long sec = ALOE_EV_INFINITE,
+		unsigned long usec = 0) {
+	return readable(current(), fd, sec, usec);
+}
+
+/** Wait writable, or aloe_ev_flag_time when timeout in sec and usec. */
+inline ev_awaiter writable(void *ctx, int fd,
+		unsigned long sec = ALOE_EV_INFINITE, unsigned long usec = 0) {
+	return ev_awaiter(ctx, fd, aloe_ev_flag_write, sec, usec);
+}
+
+inline ev_awaiter writable(int fd, unsigned long sec = ALOE_EV_INFINITE,
+		unsigned long usec = 0) {
+	return writable(current(), fd, sec, usec);
+}
+
+/** Resume after the duration. */
+template <typename Rep, typename Period>
+inline ev_awaiter sleep_for(void *ctx,
+		std::chrono::duration<Rep, Period> dur) {
+	unsigned long us = (unsigned long)
+			std::chrono::duration_cast<std::chrono::microseconds>(dur).count();
+
+	return ev_awaiter(ctx, -1, 0, us / 1000000ul, us % 1000000ul);
+}
+
+template <typename Rep, typename Period>
+inline ev_awaiter sleep_for(std::chrono::duration<Rep, Period> dur) {
+	return sleep_for(current(), dur);
+}
+
+/** Resume after milli-seconds. */
+inline ev_awaiter sleep_for(unsigned long ms) {
+	return sleep_for(current(), std::chrono::milliseconds(ms));
+}
+
+/** @} ALOE_EV_CO */
+
+} // namespace ev
+} // namespace aloe
+
+#endif /* _H_ALOE_EV_CO */
@@ -125,24 +125,164 @@ size_t aloe_rinbuf_read(aloe_buf_t *buf, void *data, size_t sz);
  */
 size_t aloe_rinbuf_write(aloe_buf_t *buf, const void *data, size_t sz);
 
+/**
+ * Read from fd into spare of ring buffer, in one readv() of at most 2
+ * segment.
+ *
+ * fb.pos: Start of valid data
+ * fb.lmt: Size of valid data
+ *
+ * @param buf
+ * @param fd
+ * @return Size read, 0 when end of file, -1 with errno
+ */
+ssize_t aloe_rinbuf_readv_fd(aloe_buf_t *buf, int fd);
+
+/**
+ * Write data in ring buffer to fd, in one writev() of at most 2 segment.
+ *
+ * fb.pos: Start of valid data
+ * fb.lmt: Size of valid data
+ *
+ * @param buf
+ * @param fd
+ * @return Size written, -1 with errno
+ */
+ssize_t aloe_rinbuf_writev_fd(aloe_buf_t *buf, int fd);
+
 #define aloe_buf_clear(_buf) do {(_buf)->lmt = (_buf)->cap; (_buf)->pos = 0;} while (0)
 #define aloe_buf_flip(_buf) do {(_buf)->lmt = (_buf)->pos; (_buf)->pos = 0;} while (0)
 
 void aloe_buf_shift_left(aloe_buf_t *buf, size_t offset);
 
+/** Cache line size to keep data modified by different thread apart. */
+#define ALOE_CACHELINE_SIZE 64
+
+typedef enum aloe_ring_flag_enum {
+	aloe_ring_flag_none = 0,
+	/** Single producer and single consumer in different thread. */
+	aloe_ring_flag_spsc = (1 << 0),
+	/**
+	 * Map the memory twice back to back, data and spare always continuous.
+	 *
+	 * Capacity round up to page size.
+	 */
+	aloe_ring_flag_mirror = (1 << 1),
+} aloe_ring_flag_t;
+
+/**
+ * Ring buffer in power of 2 capacity.
+ *
+ * head and tail are free running counter, masked to index the data, the
+ * difference is the data size.  The producer only advance head and the
+ * consumer only advance tail, each on separated cache line.
+ */
+typedef struct aloe_ring_rec {
+	void *data; /**< Memory pointer. */
+	size_t mask; /**< Capacity minus 1. */
+	unsigned flag; /**< aloe_ring_flag_t. */
+
+	/** Data start, advanced by consumer. */
+	size_t tail __attribute__((aligned(ALOE_CACHELINE_SIZE)));
+	size_t head_cache; /**< head last seen by consumer. */
+
+	/** Data end, advanced by producer. */
+	size_t head __attribute__((aligned(ALOE_CACHELINE_SIZE)));
+	size_t tail_cache; /**< tail last seen by producer. */
+} aloe_ring_t;
+
+#define aloe_ring_cap(_ring) ((_ring)->mask + 1)
+
+/**
+ * Allocate data, capacity round up to power of 2.
+ *
+ * @param ring
+ * @param cap
+ * @param flag aloe_ring_flag_t
+ * @return 0 or errno
+ */
+int aloe_ring_init(aloe_ring_t *ring, size_t cap, unsigned flag);
+void aloe_ring_destroy(aloe_ring_t *ring);
+
+/** Size of data, exact for consumer and lower bound for producer. */
+size_t aloe_ring_len(aloe_ring_t *ring);
+
+/** Size of spare, exact for producer and lower bound for consumer. */
+size_t aloe_ring_spare(aloe_ring_t *ring);
+
+/**
+ * Consumer take data.
+ *
+ * @param ring
+ * @param data NULL to drop
+ * @param sz
+ * @return Size read
+ */
+size_t aloe_ring_read(aloe_ring_t *ring, void *data, size_t sz);
+
+/**
+ * Producer put data.
+ *
+ * @param ring
+ * @param data
+ * @param sz
+ * @return Size written
+ */
+size_t aloe_ring_write(aloe_ring_t *ring, const void *data, size_t sz);
+
+/**
+ * Consumer locate data without copy.
+ *
+ * Continuous till the wrap, or all data with aloe_ring_flag_mirror.
+ *
+ * @param ring
+ * @param sz Size of data located
+ * @return Data start
+ */
+void* aloe_ring_read_peek(aloe_ring_t *ring, size_t *sz);
+
+/** Consumer done with data located by aloe_ring_read_peek(). */
+void aloe_ring_read_commit(aloe_ring_t *ring, size_t sz);
+
+/**
+ * Producer locate spare to fill in place.
+ *
+ * Continuous till the wrap, or all spare with aloe_ring_flag_mirror.
+ *
+ * @param ring
+ * @param sz Size of spare located
+ * @return Spare start
+ */
+void* aloe_ring_write_peek(aloe_ring_t *ring, size_t *sz);
+
+/** Producer publish data filled in spare located by aloe_ring_write_peek(). */
+void aloe_ring_write_commit(aloe_ring_t *ring, size_t sz);
+
+/** Drop all data, not safe when producer and consumer running. */
+#define aloe_ring_clear(_ring) do { \
+	(_ring)->tail = (_ring)->tail_cache = (_ring)->head_cache = (_ring)->head; \
+} while (0)
+
 typedef enum aloe_buf_flag_enum {
 	aloe_buf_flag_none = 0,
 	aloe_buf_flag_retain_rinbuf,
 	aloe_buf_flag_retain_index,
+	aloe_buf_flag_retain_mask = 0xf, /**< Retain mode above. */
+
+	/** Grow to at least double capacity, amortized allocation. */
+	aloe_buf_flag_grow = (1 << 4),
 } aloe_buf_flag_t;
 
 /**
  *
  * aloe_buf_flag_retain_pos will update lmt if lmt == cap
  *
+ * Memory realloc in place when retain mode keep the data, ring buffer stay
+ * wrapped with data before the wrap moved to the end.
+ *
  * @param buf
  * @param cap
- * @param retain
+ * @param retain Retain mode, or with aloe_buf_flag_grow
  * @return
  */
 int aloe_buf_expand(aloe_buf_t *buf, size_t cap, aloe_buf_flag_t retain);
@@ -165,6 +305,9 @@ int aloe_buf_printf(aloe_buf_t *buf, const char *fmt, ...)
  *
  * Malloc with max and buf.lmt == cap
  *
+ * Measure in spare first, expand at least double and format again only when
+ * spare not enough.
+ *
  * @param buf
  * @param max
  * @param fmt
@@ -176,6 +319,53 @@ int aloe_buf_vaprintf(aloe_buf_t *buf, ssize_t max, const char *fmt,
 int aloe_buf_aprintf(aloe_buf_t *buf, ssize_t max, const char *fmt, ...)
 		__attribute__((format(printf, 3, 4)));
 
+/** Size class of buffer pool, 64 bytes to 64K bytes in power of 2. */
+#define ALOE_BUF_POOL_CLASS 11
+
+/** Statistic of buffer pool in a size class. */
+typedef struct aloe_buf_pool_stat_rec {
+	size_t cap; /**< Size class, 0 for larger buffer. */
+	unsigned long hit; /**< Acquired from the pool. */
+	unsigned long miss; /**< Acquired from malloc. */
+	unsigned long release; /**< Released to the pool. */
+	unsigned long drop; /**< Released to free. */
+	unsigned long spare; /**< Buffer in the pool. */
+} aloe_buf_pool_stat_t;
+
+/**
+ * Buffer from pool of the calling thread, capacity round up to size class.
+ *
+ * buf.pos = 0, buf.lmt = buf.cap, like aloe_buf_clear()
+ *
+ * @param buf
+ * @param cap
+ * @return 0 or ENOMEM
+ */
+int aloe_buf_acquire(aloe_buf_t *buf, size_t cap);
+
+/**
+ * Return memory to pool of the calling thread, or free.
+ *
+ * The memory may come from aloe_buf_acquire() or malloc, the buffer reset to
+ * empty.
+ *
+ * @param buf
+ */
+void aloe_buf_release(aloe_buf_t *buf);
+
+/**
+ * Statistic of pool in the calling thread.
+ *
+ * @param stat Fill per size class, then for larger buffer
+ * @param cnt Capacity of stat
+ * @param reset Zero the counter after read
+ * @return Size class filled
+ */
+int aloe_buf_pool_stat(aloe_buf_pool_stat_t *stat, int cnt, int reset);
+
+/** Free memory in pool of the calling thread, before the thread exit. */
+void aloe_buf_pool_clean(void);
+
 typedef struct aloe_mod_rec {
 	const char *name;
 	void* (*init)(void);
@@ -217,6 +407,15 @@ int aloe_file_nonblock(int fd, int en);
 
 int aloe_ip_listener(struct sockaddr*, int backlog);
 
+/** Option to create listener. */
+typedef enum aloe_ip_listener_flag_enum {
+	/** Share the port with other listener, ie. one per reactor thread. */
+	aloe_ip_listener_flag_reuseport = (1 << 0),
+} aloe_ip_listener_flag_t;
+
+/** Create listener with option in aloe_ip_listener_flag_t. */
+int aloe_ip_listener2(struct sockaddr*, int backlog, unsigned flag);
+
 #define aloe_ipv6_listener(_p, _bg) aloe_ip_listener(&(struct sockaddr_in6){ \
 	.sin6_port = htons(_p), .sin6_family = AF_INET6, .sin6_addr = in6addr_any}, \
 	_bg)
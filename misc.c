@@ -14,6 +14,12 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#if HAVE_DECL___NR_MEMFD_CREATE
+#  include <linux/memfd.h>
+#endif
 
 
 static const char* _aloe_str_negative_lut[] = {
@@ -80,6 +86,228 @@ size_t aloe_rinbuf_write(aloe_buf_t *buf, const void *data, size_t sz) {
 	return ret_sz;
 }
 
+ssize_t aloe_rinbuf_readv_fd(aloe_buf_t *buf, int fd) {
+	struct iovec iov[2];
+	size_t rw_pos, rw_sz;
+	ssize_t r;
+	int iovcnt = 0;
+
+	if ((rw_sz = buf->cap - buf->lmt) <= 0) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	rw_pos = (buf->pos + buf->lmt) % buf->cap;
+	iov[iovcnt].iov_base = (char*)buf->data + rw_pos;
+	iov[iovcnt++].iov_len = aloe_min(rw_sz, buf->cap - rw_pos);
+	if (rw_sz > iov[0].iov_len) {
+		iov[iovcnt].iov_base = buf->data;
+		iov[iovcnt++].iov_len = rw_sz - iov[0].iov_len;
+	}
+	if ((r = readv(fd, iov, iovcnt)) > 0) buf->lmt += r;
+	return r;
+}
+
+ssize_t aloe_rinbuf_writev_fd(aloe_buf_t *buf, int fd) {
+	struct iovec iov[2];
+	ssize_t r;
+	int iovcnt = 0;
+
+	if (buf->lmt <= 0) return 0;
+	iov[iovcnt].iov_base = (char*)buf->data + buf->pos;
+	iov[iovcnt++].iov_len = aloe_min(buf->lmt, buf->cap - buf->pos);
+	if (buf->lmt > iov[0].iov_len) {
+		iov[iovcnt].iov_base = buf->data;
+		iov[iovcnt++].iov_len = buf->lmt - iov[0].iov_len;
+	}
+	if ((r = writev(fd, iov, iovcnt)) > 0) {
+		buf->pos = (buf->pos + r) % buf->cap;
+		buf->lmt -= r;
+	}
+	return r;
+}
+
+/** Load index advanced by the other side. */
+static inline size_t ring_load(const aloe_ring_t *ring, const size_t *idx) {
+	if (ring->flag & aloe_ring_flag_spsc) {
+		return __atomic_load_n(idx, __ATOMIC_ACQUIRE);
+	}
+	return *idx;
+}
+
+/** Publish own index after data copied. */
+static inline void ring_store(aloe_ring_t *ring, size_t *idx, size_t val) {
+	if (ring->flag & aloe_ring_flag_spsc) {
+		__atomic_store_n(idx, val, __ATOMIC_RELEASE);
+		return;
+	}
+	*idx = val;
+}
+
+/** Map memfd twice in reserved address space. */
+static void* ring_mirror_map(size_t sz) {
+#if HAVE_DECL___NR_MEMFD_CREATE
+	void *addr;
+	int fd, r;
+
+	if ((fd = (int)syscall(__NR_memfd_create, "aloe_ring", MFD_CLOEXEC)) == -1) {
+		r = errno;
+		log_e("Failed create memfd: %s(%d)\n", strerror(r), r);
+		return NULL;
+	}
+	if (ftruncate(fd, sz) != 0) {
+		r = errno;
+		log_e("Failed resize memfd: %s(%d)\n", strerror(r), r);
+		close(fd);
+		return NULL;
+	}
+	if ((addr = mmap(NULL, sz * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+			-1, 0)) == MAP_FAILED) {
+		r = errno;
+		log_e("Failed reserve ring: %s(%d)\n", strerror(r), r);
+		close(fd);
+		return NULL;
+	}
+	if (mmap(addr, sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd,
+			0) == MAP_FAILED || mmap((char*)addr + sz, sz,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0)
+			== MAP_FAILED) {
+		r = errno;
+		log_e("Failed map ring: %s(%d)\n", strerror(r), r);
+		munmap(addr, sz * 2);
+		close(fd);
+		return NULL;
+	}
+	// mapping keep the memory
+	close(fd);
+	return addr;
+#else
+	(void)sz;
+	log_e("Mirrored ring not supported\n");
+	return NULL;
+#endif
+}
+
+int aloe_ring_init(aloe_ring_t *ring, size_t cap, unsigned flag) {
+	size_t sz = 1;
+
+	if (cap <= 0 || cap > ((size_t)-1 >> 2) + 1) return EINVAL;
+	if (flag & aloe_ring_flag_mirror) {
+		long pg = sysconf(_SC_PAGESIZE);
+
+		if (pg > 0) sz = (size_t)pg;
+	}
+	for ( ; sz < cap; sz <<= 1);
+	if (flag & aloe_ring_flag_mirror) {
+		if (!(ring->data = ring_mirror_map(sz))) return ENOMEM;
+	} else if (!(ring->data = malloc(sz))) {
+		return ENOMEM;
+	}
+	ring->mask = sz - 1;
+	ring->flag = flag;
+	ring->tail = ring->head_cache = 0;
+	ring->head = ring->tail_cache = 0;
+	return 0;
+}
+
+void aloe_ring_destroy(aloe_ring_t *ring) {
+	if (!ring->data) return;
+	if (ring->flag & aloe_ring_flag_mirror) {
+		munmap(ring->data, aloe_ring_cap(ring) * 2);
+	} else {
+		free(ring->data);
+	}
+	ring->data = NULL;
+}
+
+size_t aloe_ring_len(aloe_ring_t *ring) {
+	size_t tail = ring_load(ring, &ring->tail);
+
+	return ring_load(ring, &ring->head) - tail;
+}
+
+size_t aloe_ring_spare(aloe_ring_t *ring) {
+	return aloe_ring_cap(ring) - aloe_ring_len(ring);
+}
+
+/** Continuous size from the index. */
+static inline size_t ring_span(const aloe_ring_t *ring, size_t pos,
+		size_t sz) {
+	if (ring->flag & aloe_ring_flag_mirror) return sz;
+	return aloe_min(sz, aloe_ring_cap(ring) - pos);
+}
+
+/** Consumer limit sz to data, load head only when cached not enough. */
+static size_t ring_readable(aloe_ring_t *ring, size_t sz) {
+	size_t tail = ring->tail;
+
+	if (sz > ring->head_cache - tail) {
+		ring->head_cache = ring_load(ring, &ring->head);
+		if (sz > ring->head_cache - tail) sz = ring->head_cache - tail;
+	}
+	return sz;
+}
+
+/** Producer limit sz to spare, load tail only when cached not enough. */
+static size_t ring_writable(aloe_ring_t *ring, size_t sz) {
+	size_t head = ring->head;
+
+	if (sz > aloe_ring_cap(ring) - (head - ring->tail_cache)) {
+		ring->tail_cache = ring_load(ring, &ring->tail);
+		if (sz > aloe_ring_cap(ring) - (head - ring->tail_cache)) {
+			sz = aloe_ring_cap(ring) - (head - ring->tail_cache);
+		}
+	}
+	return sz;
+}
+
+size_t aloe_ring_read(aloe_ring_t *ring, void *data, size_t sz) {
+	size_t pos, rw_sz;
+
+	if ((sz = ring_readable(ring, sz)) <= 0) return 0;
+	if (data) {
+		pos = ring->tail & ring->mask;
+		rw_sz = ring_span(ring, pos, sz);
+		memcpy(data, (char*)ring->data + pos, rw_sz);
+		if (rw_sz < sz) memcpy((char*)data + rw_sz, ring->data, sz - rw_sz);
+	}
+	ring_store(ring, &ring->tail, ring->tail + sz);
+	return sz;
+}
+
+size_t aloe_ring_write(aloe_ring_t *ring, const void *data, size_t sz) {
+	size_t pos, rw_sz;
+
+	if ((sz = ring_writable(ring, sz)) <= 0) return 0;
+	pos = ring->head & ring->mask;
+	rw_sz = ring_span(ring, pos, sz);
+	memcpy((char*)ring->data + pos, data, rw_sz);
+	if (rw_sz < sz) memcpy(ring->data, (char*)data + rw_sz, sz - rw_sz);
+	ring_store(ring, &ring->head, ring->head + sz);
+	return sz;
+}
+
+void* aloe_ring_read_peek(aloe_ring_t *ring, size_t *sz) {
+	size_t pos = ring->tail & ring->mask;
+
+	*sz = ring_span(ring, pos, ring_readable(ring, aloe_ring_cap(ring)));
+	return (char*)ring->data + pos;
+}
+
+void aloe_ring_read_commit(aloe_ring_t *ring, size_t sz) {
+	ring_store(ring, &ring->tail, ring->tail + sz);
+}
+
+void* aloe_ring_write_peek(aloe_ring_t *ring, size_t *sz) {
+	size_t pos = ring->head & ring->mask;
+
+	*sz = ring_span(ring, pos, ring_writable(ring, aloe_ring_cap(ring)));
+	return (char*)ring->data + pos;
+}
+
+void aloe_ring_write_commit(aloe_ring_t *ring, size_t sz) {
+	ring_store(ring, &ring->head, ring->head + sz);
+}
+
 void aloe_buf_shift_left(aloe_buf_t *buf, size_t offset) {
 	if (!buf->data || offset > buf->pos || buf->pos > buf->lmt) return;
 	memmove(buf->data, (char*)buf->data + offset, buf->pos - offset);
@@ -88,20 +316,30 @@ void aloe_buf_shift_left(aloe_buf_t *buf, size_t offset) {
 }
 
 int aloe_buf_expand(aloe_buf_t *buf, size_t cap, aloe_buf_flag_t retain) {
+	aloe_buf_flag_t flag = retain;
+	size_t cap_old = buf->cap;
 	void *data;
 
+	retain = (aloe_buf_flag_t)(flag & aloe_buf_flag_retain_mask);
 	if (cap <= 0 || buf->cap >= cap) return 0;
-	if (!(data = malloc(cap))) return ENOMEM;
-	if (buf->data) {
-		if (retain == aloe_buf_flag_retain_rinbuf) {
-			aloe_rinbuf_read(buf, data, buf->lmt);
-			buf->pos = 0;
-		} else if (retain == aloe_buf_flag_retain_index) {
-			memcpy(data, (char*)buf->data, buf->pos);
-			if (buf->lmt == buf->cap) buf->lmt = cap;
+	if ((flag & aloe_buf_flag_grow) && cap < buf->cap * 2) cap = buf->cap * 2;
+	if (!buf->data || retain == aloe_buf_flag_none) {
+		// nothing to keep, save realloc copy
+		if (!(data = malloc(cap))) return ENOMEM;
+		if (buf->data) free(buf->data);
+	} else {
+		if (!(data = realloc(buf->data, cap))) return ENOMEM;
+		if (retain == aloe_buf_flag_retain_rinbuf
+				&& buf->pos + buf->lmt > cap_old) {
+			// data before wrap move to the end
+			size_t sz = cap_old - buf->pos;
+
+			memmove((char*)data + cap - sz, (char*)data + buf->pos, sz);
+			buf->pos = cap - sz;
 		}
-		free(buf->data);
-	} else if (retain == aloe_buf_flag_retain_index) {
+	}
+	if (retain == aloe_buf_flag_retain_index
+			&& (!buf->data || buf->lmt == cap_old)) {
 		buf->lmt = cap;
 	}
 	buf->data = data;
@@ -131,6 +369,8 @@ int aloe_buf_printf(aloe_buf_t *buf, const char *fmt, ...) {
 
 int aloe_buf_vaprintf(aloe_buf_t *buf, ssize_t max, const char *fmt,
 		va_list va) {
+	size_t spare, cap;
+	va_list vb;
 	int r;
 
 	if (!fmt || !fmt[0]) return 0;
@@ -138,33 +378,30 @@ int aloe_buf_vaprintf(aloe_buf_t *buf, ssize_t max, const char *fmt,
 	if (max == 0 || buf->lmt != buf->cap) {
 		return aloe_buf_vprintf(buf, fmt, va);
 	}
-	if (aloe_buf_expand(buf, ((max > 0 && max < 32) ? max : 32),
-			aloe_buf_flag_retain_index) != 0) {
-		return -1;
-	}
-
-	while (1) {
-		va_list vb;
 
+	// measure in spare, the result taken when fulfilled
+	spare = (buf->data ? buf->cap - buf->pos : 0);
 #if __STDC_VERSION__ < 199901L
 #  warning "va_copy() may require C99"
 #endif
-		va_copy(vb, va);
-		r = aloe_buf_vprintf(buf, fmt, vb);
-		if (r < 0 || r >= buf->cap) {
-			if (max > 0 && buf->cap >= max) return -1;
-			r = buf->cap * 2;
-			if (max > 0 && r > max) r = max;
-			if (aloe_buf_expand(buf, r, aloe_buf_flag_retain_index) != 0) {
-				va_end(vb);
-				return -1;
-			}
-			va_end(vb);
-			continue;
-		}
-		va_end(vb);
+	va_copy(vb, va);
+	r = vsnprintf((spare > 0 ? (char*)buf->data + buf->pos : NULL), spare,
+			fmt, vb);
+	va_end(vb);
+	if (r < 0) return -1;
+	if ((size_t)r < spare) {
+		buf->pos += r;
 		return r;
-	};
+	}
+
+	cap = buf->pos + r + 1;
+	if (max > 0 && cap > (size_t)max) return -1;
+
+	// geometric growth in the limit
+	cap = aloe_max(cap, aloe_max(buf->cap * 2, 32));
+	if (max > 0 && cap > (size_t)max) cap = max;
+	if (aloe_buf_expand(buf, cap, aloe_buf_flag_retain_index) != 0) return -1;
+	return aloe_buf_vprintf(buf, fmt, va);
 }
 
 int aloe_buf_aprintf(aloe_buf_t *buf, ssize_t max, const char *fmt, ...) {
@@ -178,6 +415,111 @@ int aloe_buf_aprintf(aloe_buf_t *buf, ssize_t max, const char *fmt, ...) {
 	return r;
 }
 
+/** Smallest size class in shift. */
+#define BUF_POOL_SHIFT 6
+
+/** Bytes kept in pool per size class, at least BUF_POOL_KEEP_MIN buffer. */
+#define BUF_POOL_KEEP (256ul << 10)
+#define BUF_POOL_KEEP_MIN 4
+
+typedef struct buf_pool_link_rec {
+	struct buf_pool_link_rec *next;
+} buf_pool_link_t;
+
+static __thread struct {
+	buf_pool_link_t *spare[ALOE_BUF_POOL_CLASS];
+	aloe_buf_pool_stat_t stat[ALOE_BUF_POOL_CLASS + 1];
+} buf_pool;
+
+/** Size class to hold cap, ALOE_BUF_POOL_CLASS for larger. */
+static int buf_pool_class(size_t cap) {
+	int cls;
+
+	if (cap <= (1ul << BUF_POOL_SHIFT)) return 0;
+	cls = (int)(sizeof(unsigned long) * 8) - __builtin_clzl(cap - 1)
+			- BUF_POOL_SHIFT;
+	return aloe_min(cls, ALOE_BUF_POOL_CLASS);
+}
+
+int aloe_buf_acquire(aloe_buf_t *buf, size_t cap) {
+	int cls = buf_pool_class(cap);
+	aloe_buf_pool_stat_t *stat = &buf_pool.stat[cls];
+	buf_pool_link_t *link;
+
+	if (cls < ALOE_BUF_POOL_CLASS && (link = buf_pool.spare[cls])) {
+		buf_pool.spare[cls] = link->next;
+		stat->spare--;
+		stat->hit++;
+		buf->data = (void*)link;
+		buf->cap = 1ul << (cls + BUF_POOL_SHIFT);
+	} else {
+		if (cls < ALOE_BUF_POOL_CLASS) cap = 1ul << (cls + BUF_POOL_SHIFT);
+		if (!(buf->data = malloc(cap))) return ENOMEM;
+		stat->miss++;
+		buf->cap = cap;
+	}
+	buf->pos = 0;
+	buf->lmt = buf->cap;
+	return 0;
+}
+
+void aloe_buf_release(aloe_buf_t *buf) {
+	int cls;
+	aloe_buf_pool_stat_t *stat;
+	buf_pool_link_t *link = (buf_pool_link_t*)buf->data;
+
+	if (!link) return;
+	cls = buf_pool_class(buf->cap);
+	stat = &buf_pool.stat[cls];
+
+	// take only memory exactly in size class
+	if (cls < ALOE_BUF_POOL_CLASS
+			&& buf->cap == (1ul << (cls + BUF_POOL_SHIFT))
+			&& (stat->spare < BUF_POOL_KEEP_MIN
+					|| (stat->spare + 1) * buf->cap <= BUF_POOL_KEEP)) {
+		link->next = buf_pool.spare[cls];
+		buf_pool.spare[cls] = link;
+		stat->spare++;
+		stat->release++;
+	} else {
+		free(link);
+		stat->drop++;
+	}
+	buf->data = NULL;
+	buf->cap = buf->lmt = buf->pos = 0;
+}
+
+int aloe_buf_pool_stat(aloe_buf_pool_stat_t *stat, int cnt, int reset) {
+	int i;
+
+	for (i = 0; i <= ALOE_BUF_POOL_CLASS; i++) {
+		aloe_buf_pool_stat_t *slot = &buf_pool.stat[i];
+
+		if (stat && i < cnt) {
+			stat[i] = *slot;
+			stat[i].cap = ((i < ALOE_BUF_POOL_CLASS) ?
+					(1ul << (i + BUF_POOL_SHIFT)) : 0);
+		}
+		if (reset) {
+			slot->hit = slot->miss = slot->release = slot->drop = 0;
+		}
+	}
+	return aloe_min(cnt, ALOE_BUF_POOL_CLASS + 1);
+}
+
+void aloe_buf_pool_clean(void) {
+	buf_pool_link_t *link;
+	int i;
+
+	for (i = 0; i < ALOE_BUF_POOL_CLASS; i++) {
+		while ((link = buf_pool.spare[i])) {
+			buf_pool.spare[i] = link->next;
+			free(link);
+		}
+		buf_pool.stat[i].spare = 0;
+	}
+}
+
 ssize_t _aloe_file_size(const void *f, int fd) {
 	struct stat st;
 	int r;
@@ -295,7 +637,7 @@ int _aloe_file_stdout(const char *fname, FILE **sfp, int sfd) {
 	return fd;
 }
 
-int aloe_ip_listener(struct sockaddr *sa, int backlog) {
+int aloe_ip_listener2(struct sockaddr *sa, int backlog, unsigned flag) {
 	int fd = -1, r, af = aloe_sockaddr_family(sa);
 	socklen_t sa_len;
 
@@ -328,6 +670,22 @@ int aloe_ip_listener(struct sockaddr *sa, int backlog) {
 			return -1;
 		}
 	}
+	if ((flag & aloe_ip_listener_flag_reuseport)
+			&& (af == AF_INET || af == AF_INET6)) {
+#ifdef SO_REUSEPORT
+		r = 1;
+		if ((r = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &r, sizeof(r))) < 0) {
+			r = errno;
+			close(fd);
+			log_e("Failed set ip socket reuseport, %s(%d)\n", strerror(r), r);
+			return -1;
+		}
+#else
+		close(fd);
+		log_e("Unsupported ip socket reuseport\n");
+		return -1;
+#endif
+	}
 	if ((r = bind(fd, sa, sa_len)) < 0) {
 		r = errno;
 		close(fd);
@@ -343,3 +701,7 @@ int aloe_ip_listener(struct sockaddr *sa, int backlog) {
 	return fd;
 }
 
+int aloe_ip_listener(struct sockaddr *sa, int backlog) {
+	return aloe_ip_listener2(sa, backlog, 0);
+}
+
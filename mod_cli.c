@@ -20,6 +20,7 @@ static char mod_name[] = "cli";
 typedef struct conn_rec {
 	int fd;
 	void *ev, *ctx;
+	aloe_buf_t rbuf; /**< Ring buffer for input. */
 	TAILQ_ENTRY(conn_rec) qent;
 } conn_t;
 typedef TAILQ_HEAD(conn_queue_rec, conn_rec) conn_queue_t;
@@ -39,43 +40,49 @@ static void ctrl_on_input(conn_t *listener, const aloe_buf_t *buf) {
 	log_d("Control command append: %s\n", (char*)buf->data);
 }
 
+/** Log line complete in ring, or all when ring full without line end. */
+static void ctrl_on_line(conn_t *conn) {
+	aloe_buf_t *buf = &conn->rbuf;
+	const char *data = (const char*)buf->data;
+	size_t len, seg;
+
+	while (buf->lmt > 0) {
+		for (len = 0; len < buf->lmt; len++) {
+			size_t idx = buf->pos + len;
+
+			if (idx >= buf->cap) idx -= buf->cap;
+			if (data[idx] == '\n') break;
+		}
+		if (len >= buf->lmt && buf->lmt < buf->cap) return;
+
+		// the line may wrap
+		seg = aloe_min(len, buf->cap - buf->pos);
+		log_d("Control command append: %.*s%.*s\n", (int)seg,
+				data + buf->pos, (int)(len - seg), data);
+		if (len < buf->lmt) len++;
+		buf->pos = (buf->pos + len) % buf->cap;
+		buf->lmt -= len;
+	}
+}
+
 static void ctrl_on_read(int fd, unsigned ev_noti, void *cbarg) {
 	conn_t *listener = (conn_t*)cbarg;
 	ctx_t *ctx = (ctx_t*)listener->ctx;
-	aloe_buf_t buf = {.data = NULL};
 	int r;
 
 	log_d("instanceId: %d, ev_noti: %d\n", ctx->instanceId, ev_noti);
 
-	if ((aloe_buf_expand(&buf, 500, aloe_buf_flag_none)) != 0) {
-		log_e("Failed alloc memory to get control command\n");
-		goto finally;
-	}
-	aloe_buf_clear(&buf);
-	r = read(fd, buf.data, buf.lmt - buf.pos - 1);
-	if (r < 0) {
+	if ((r = aloe_rinbuf_readv_fd(&listener->rbuf, fd)) < 0) {
 		r = errno;
-		if (ALOE_ENO_NONBLOCKING(r) || r == EINTR) {
-			r = 0;
-			goto finally;
-		}
+		if (ALOE_ENO_NONBLOCKING(r) || r == EINTR) return;
 		log_e("Failed read control command: %s\n", strerror(r));
-		goto finally;
+		return;
 	}
 	if (r == 0) {
 		log_d("Remote closed control command\n");
-		goto finally;
+		return;
 	}
-	((char*)buf.data)[buf.pos += r] = '\0';
-	aloe_buf_flip(&buf);
-	log_d("Control command append: %s\n", (char*)buf.data);
-	r = 0;
-finally:
-	if (!(listener->ev = aloe_ev_put(ev_ctx, listener->fd, &ctrl_on_read,
-			listener, aloe_ev_flag_read, ALOE_EV_INFINITE, 0))) {
-		log_e("Failed schedule read unix socket\n");
-	}
-	if (buf.data) free(buf.data);
+	ctrl_on_line(listener);
 }
 
 static void ctrl_on_accept(int fd, unsigned ev_noti, void *cbarg) {
@@ -84,6 +91,9 @@ static void ctrl_on_accept(int fd, unsigned ev_noti, void *cbarg) {
 //	conn_t *conn = NULL;
 	int r;
 
+	// one shot notify released
+	listener->ev = NULL;
+
 	log_d("instanceId: %d, ev_noti: %d\n", ctx->instanceId, ev_noti);
 //	if ((conn = malloc(sizeof(*conn))) == NULL) {
 //		r = ENOMEM;
@@ -113,12 +123,20 @@ static void* init(void) {
 		conn->fd = -1;
 		conn->ev = NULL;
 		conn->ctx = ctx;
+		conn->rbuf = (aloe_buf_t){.data = NULL};
 	}
 	ctx->instanceId = instanceId++;
 
-	if (ctrl_path && ctrl_path[0]) {
+	// fifo not shardable, serve from the first reactor
+	if (ctrl_path && ctrl_path[0] && reactor_id == 0) {
 		conn_t *listener = &ctx->ctrl_listener[0];
 
+		if ((r = aloe_buf_acquire(&listener->rbuf, 500)) != 0) {
+			log_e("Failed alloc memory to get control command\n");
+			goto finally;
+		}
+		listener->rbuf.pos = listener->rbuf.lmt = 0;
+
 		mkfifo(ctrl_path, 0666);
 		if ((listener->fd = open(ctrl_path, O_RDWR, 0666)) == -1) {
 			r = errno;
@@ -131,7 +149,8 @@ static void* init(void) {
 			goto finally;
 		}
 		if (!(listener->ev = aloe_ev_put(ev_ctx, listener->fd, &ctrl_on_read,
-				listener, aloe_ev_flag_read, ALOE_EV_INFINITE, 0))) {
+				listener, aloe_ev_flag_read | aloe_ev_flag_persist,
+				ALOE_EV_INFINITE, 0))) {
 			r = -1;
 			log_e("Failed schedule read unix socket\n");
 			goto finally;
@@ -147,9 +166,11 @@ static void* init(void) {
 		struct sockaddr_in sa;
 		socklen_t sa_len;
 
-		if ((listener->fd = aloe_ip_listener((struct sockaddr*)
+		// shard the port among reactors
+		if ((listener->fd = aloe_ip_listener2((struct sockaddr*)
 				&(struct sockaddr_in){.sin_port = htons(_ctrl_port),
-				.sin_family = AF_INET, .sin_addr = {INADDR_ANY}}, 3)) == -1) {
+				.sin_family = AF_INET, .sin_addr = {INADDR_ANY}}, 3,
+				(reactor_cnt > 1 ? aloe_ip_listener_flag_reuseport : 0))) == -1) {
 			r = -1;
 			log_e("Failed listen ip port %d\n", _ctrl_port);
 			goto finally;
@@ -160,6 +181,10 @@ static void* init(void) {
 			log_e("Failed checkout listen ip port\n");
 			goto finally;
 		}
+		// rest reactors join the port allocated
+		if (ctrl_port == CTRL_PORT_ANY && reactor_cnt > 1) {
+			ctrl_port = ntohs(sa.sin_port);
+		}
 
 		if ((r = aloe_file_nonblock(listener->fd, 1)) != 0) {
 			log_e("Failed set ip port nonblock\n");
@@ -183,7 +208,8 @@ finally:
 			for (i = 0; i < aloe_arraysize(ctx->ctrl_listener); i++) {
 				conn_t *conn = &ctx->ctrl_listener[i];
 				if (conn->fd != -1) close(conn->fd);
-				if (!conn->ev) aloe_ev_cancel(ev_ctx, conn->ev);
+				if (conn->ev) aloe_ev_cancel(ev_ctx, conn->ev);
+				aloe_buf_release(&conn->rbuf);
 			}
 			free(ctx);
 		}
@@ -194,8 +220,16 @@ finally:
 
 static void destroy(void *_ctx) {
 	ctx_t *ctx = (ctx_t*)_ctx;
+	int i;
 
 	log_d("%s[%d]\n", mod_name, ctx->instanceId);
+	for (i = 0; i < aloe_arraysize(ctx->ctrl_listener); i++) {
+		conn_t *conn = &ctx->ctrl_listener[i];
+
+		if (conn->ev) aloe_ev_cancel(ev_ctx, conn->ev);
+		if (conn->fd != -1) close(conn->fd);
+		aloe_buf_release(&conn->rbuf);
+	}
 	free(ctx);
 }
 
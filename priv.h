@@ -56,40 +56,281 @@ extern const char *ctrl_path;
 #define CTRL_PORT_NONE -1
 extern int ctrl_port;
 
-extern void *ev_ctx;
+/** Event context of the reactor running in this thread. */
+extern __thread void *ev_ctx;
+
+/** Reactor running in this thread, 0 for the first. */
+extern __thread int reactor_id;
+
+/** Count of reactors, each thread run an event context. */
+extern int reactor_cnt;
+
+/** Where the notify linked. */
+typedef enum aloe_ev_noti_state_enum {
+	aloe_ev_noti_state_none = 0, /**< Not linked. */
+	aloe_ev_noti_state_spare, /**< Released to noti_pool. */
+	aloe_ev_noti_state_fd, /**< In noti_q of ev_fd. */
+	aloe_ev_noti_state_tmr, /**< In tmr_q. */
+	aloe_ev_noti_state_ready, /**< In noti_q of context. */
+	aloe_ev_noti_state_run, /**< Persistent notify in callback. */
+	aloe_ev_noti_state_defer, /**< In defer_q. */
+	aloe_ev_noti_state_idle, /**< In idle_q. */
+} aloe_ev_noti_state_t;
+
+struct aloe_ev_ctx_fd_rec;
 
 /** Notify event to user. */
 typedef struct aloe_ev_ctx_noti_rec {
 	int fd;
+	struct aloe_ev_ctx_fd_rec *ev_fd; /**< FD record, NULL for timer. */
+	aloe_ev_noti_state_t state;
 	aloe_ev_noti_cb_t cb; /**< Callback to user. */
 	void *cbarg; /**< Callback argument. */
 	unsigned ev_wait; /**< Event to wait. */
 	struct timespec due; /**< Monotonic timeout. */
+	struct timespec intv; /**< Timeout to rearm persistent notify. */
 	unsigned ev_noti; /**< Notified event. */
+	int tmr_idx; /**< Index in timer heap, -1 when not in. */
+	aloe_ev_prio_t prio;
+	struct {
+		unsigned periodic: 1; /**< Due advance on the grid of intv. */
+		unsigned skip: 1; /**< Periodic skip missed tick. */
+	} flag;
 	TAILQ_ENTRY(aloe_ev_ctx_noti_rec) qent;
 } aloe_ev_ctx_noti_t;
 
 /** Queue of aloe_ev_noti_t. */
 typedef TAILQ_HEAD(aloe_ev_ctx_noti_queue_rec, aloe_ev_ctx_noti_rec) aloe_ev_ctx_noti_queue_t;
 
-/** FD for select(). */
+/** FD for backend. */
 typedef struct aloe_ev_ctx_fd_rec {
 	int fd; /**< FD to monitor. */
 	aloe_ev_ctx_noti_queue_t noti_q; /**< Queue of aloe_ev_noti_t for this FD. */
+	unsigned ev_reg; /**< Event registered to backend. */
+	int noti_rdy; /**< Notify of this FD in noti_q of context. */
+	struct {
+		unsigned chg: 1; /**< In change list. */
+		unsigned chg_defer: 1; /**< Change wait for notify dispatched. */
+	} flag;
 	TAILQ_ENTRY(aloe_ev_ctx_fd_rec) qent;
 } aloe_ev_ctx_fd_t;
 
 /** Queue of aloe_ev_fd_t. */
 typedef TAILQ_HEAD(aloe_ev_ctx_fd_queue_rec, aloe_ev_ctx_fd_rec) aloe_ev_ctx_fd_queue_t;
 
+/** Task posted from other thread. */
+typedef struct aloe_ev_ctx_post_rec {
+	aloe_ev_post_cb_t cb;
+	void *cbarg;
+	struct aloe_ev_ctx_post_rec *next;
+	unsigned spare_next; /**< Index plus 1 of next spare in slab, 0 for end. */
+} aloe_ev_ctx_post_t;
+
+/** Post record reused from the slab, malloc for more. */
+#define ALOE_EV_POST_SLAB 256
+
+struct aloe_ev_ctx_rec;
+
+/** Job state, changed atomically between loop and worker. */
+typedef enum aloe_ev_job_state_enum {
+	aloe_ev_job_state_queued = 0,
+	aloe_ev_job_state_running,
+	aloe_ev_job_state_cancel,
+	aloe_ev_job_state_done,
+} aloe_ev_job_state_t;
+
+/** Job for worker thread pool. */
+typedef struct aloe_ev_job_rec {
+	aloe_ev_work_cb_t work;
+	aloe_ev_work_done_cb_t done;
+	void *cbarg;
+	struct aloe_ev_ctx_rec *ctx; /**< Where to complete. */
+	int state; /**< aloe_ev_job_state_t. */
+	int r; /**< Result to done. */
+	TAILQ_ENTRY(aloe_ev_job_rec) qent; /**< In deque of worker. */
+	struct aloe_ev_job_rec *next; /**< In wq_done of context. */
+} aloe_ev_job_t;
+
+/** Asynchronous IO operation. */
+typedef enum aloe_ev_io_op_enum {
+	aloe_ev_io_op_read = 0,
+	aloe_ev_io_op_write,
+	aloe_ev_io_op_accept,
+	aloe_ev_io_op_recv,
+	aloe_ev_io_op_send,
+} aloe_ev_io_op_t;
+
+/** Asynchronous IO in flight. */
+typedef struct aloe_ev_ctx_io_rec {
+	aloe_ev_io_op_t op;
+	int fd;
+	void *buf;
+	size_t len;
+	long off; /**< File offset for read and write, -1 for current. */
+	int flags; /**< Flags for recv and send. */
+	struct sockaddr *sa; /**< Peer address for accept. */
+	socklen_t *sa_len;
+	aloe_ev_io_cb_t cb;
+	void *cbarg;
+	struct aloe_ev_ctx_rec *ctx;
+	void *ev; /**< Notify to wait readiness without io_uring. */
+	TAILQ_ENTRY(aloe_ev_ctx_io_rec) qent;
+} aloe_ev_ctx_io_t;
+
+/** Queue of aloe_ev_ctx_io_t. */
+typedef TAILQ_HEAD(aloe_ev_ctx_io_queue_rec, aloe_ev_ctx_io_rec) aloe_ev_ctx_io_queue_t;
+
+/** Backend to wait IO.
+ *
+ * Backend report ready FD with aloe_ev_fd_ready().
+ */
+typedef struct aloe_ev_backend_rec {
+	const char *name;
+
+	/** Setup ctx->backend_ctx. */
+	int (*init)(struct aloe_ev_ctx_rec*);
+
+	/** Release ctx->backend_ctx. */
+	void (*destroy)(struct aloe_ev_ctx_rec*);
+
+	/** Change event monitored for the FD from ev_fd->ev_reg to ev_wait. */
+	int (*ctl)(struct aloe_ev_ctx_rec*, aloe_ev_ctx_fd_t*, unsigned ev_wait);
+
+	/** Wait IO, NULL tmo for infinite. */
+	int (*wait)(struct aloe_ev_ctx_rec*, const struct timespec *tmo);
+} aloe_ev_backend_t;
+
+extern const aloe_ev_backend_t aloe_ev_backend_select;
+#ifdef WITH_EPOLL
+extern const aloe_ev_backend_t aloe_ev_backend_epoll;
+#endif
+
+/** Slab of records, aligned to ALOE_EV_SLAB_SIZE. */
+typedef struct aloe_ev_slab_rec {
+	TAILQ_ENTRY(aloe_ev_slab_rec) qent;
+	void *spare; /**< Free record in this slab. */
+	int used; /**< Record in use. */
+} aloe_ev_slab_t;
+
+/** Queue of aloe_ev_slab_t. */
+typedef TAILQ_HEAD(aloe_ev_slab_queue_rec, aloe_ev_slab_rec) aloe_ev_slab_queue_t;
+
+/** Pool of fixed size record. */
+typedef struct aloe_ev_pool_rec {
+	size_t rec_sz;
+	size_t link_off; /**< Where to link free record, retain the rest. */
+	int slab_rec; /**< Record per slab. */
+	aloe_ev_slab_queue_t part_q; /**< Slab have free record. */
+	aloe_ev_slab_queue_t full_q; /**< Slab all in use. */
+	unsigned long spare_max; /**< Release empty slab over, 0 to keep. */
+	aloe_ev_pool_stat_t stat;
+} aloe_ev_pool_t;
+
+/** Setup pool for record linked at link_off when free. */
+void aloe_ev_pool_init(aloe_ev_pool_t *pool, size_t rec_sz, size_t link_off,
+		unsigned long spare_max);
+
+/** Allocate slab for at least cnt record. */
+int aloe_ev_pool_reserve(aloe_ev_pool_t *pool, unsigned long cnt);
+
+/** Take a record, NULL when out of memory. */
+void* aloe_ev_pool_get(aloe_ev_pool_t *pool);
+
+/** Return the record. */
+void aloe_ev_pool_put(aloe_ev_pool_t *pool, void *rec);
+
+/** Release all slab even record in use. */
+void aloe_ev_pool_destroy(aloe_ev_pool_t *pool);
+
 /** Information about control flow and running context. */
 typedef struct aloe_ev_ctx_rec {
-	aloe_ev_ctx_fd_queue_t fd_q; /**< Queue to select(). */
-	aloe_ev_ctx_fd_queue_t spare_fd_q; /**< Queue for cached memory. */
-	aloe_ev_ctx_noti_queue_t noti_q; /**< Queue for ready to notify. */
-	aloe_ev_ctx_noti_queue_t spare_noti_q; /**< Queue for cached memory. */
+	aloe_ev_ctx_fd_queue_t fd_q; /**< Queue to monitor by backend. */
+	aloe_ev_pool_t fd_pool; /**< Memory for aloe_ev_ctx_fd_t. */
+	int fd_cnt, fd_sys; /**< FD in fd_q, and among them for internal wakeup. */
+	/** Queue for ready to notify, per priority. */
+	aloe_ev_ctx_noti_queue_t noti_q[ALOE_EV_PRIO_CNT];
+	aloe_ev_pool_t noti_pool; /**< Memory for aloe_ev_ctx_noti_t. */
+	aloe_ev_ctx_noti_queue_t tmr_q; /**< Queue for waiting without FD. */
+	aloe_ev_ctx_noti_queue_t defer_q; /**< Queue to ready in next loop. */
+	aloe_ev_ctx_noti_queue_t idle_q; /**< Queue to run when idle. */
+	aloe_ev_ctx_noti_t **tmr; /**< 4-ary min heap order by due. */
+	int tmr_cnt, tmr_cap;
+	aloe_ev_ctx_fd_t **fd_tbl; /**< Lookup monitored FD by value. */
+	int fd_tbl_cap;
+	const aloe_ev_backend_t *backend;
+	void *backend_ctx;
+	aloe_ev_ctx_fd_t **chg; /**< FD to reduce monitored event or release. */
+	int chg_cnt, chg_cap;
+	aloe_ev_ctx_post_t *post; /**< Posted task, lock free LIFO. */
+	aloe_ev_ctx_post_t *post_slab; /**< ALOE_EV_POST_SLAB records. */
+	/** Spare in post_slab, lock free LIFO of generation in high 32 bits and
+	 * index plus 1 in low 32 bits. */
+	uint64_t post_spare;
+	int post_fd[2]; /**< Wakeup by eventfd or pipe, read [0] and write [1]. */
+	void *post_ev;
+	aloe_ev_job_t *wq_done; /**< Job done by worker, lock free LIFO. */
+	aloe_ev_ctx_io_queue_t io_q; /**< Asynchronous IO in flight. */
+	void *uring; /**< NULL when io_uring not used. */
+	struct {
+		unsigned uring_chk: 1; /**< Tried setup io_uring. */
+		unsigned hires: 1; /**< Timeout in nano-seconds. */
+		unsigned precise: 1; /**< Read clock instead of now. */
+	} flag;
+	aloe_ev_tmr_stat_t tmr_stat;
+	struct timespec now; /**< Monotonic time when the loop wakeup. */
+	unsigned long budget_cb, budget_ns; /**< Dispatch per loop, 0 unlimited. */
+	aloe_ev_prof_stat_t *prof; /**< Hash by callback, NULL disabled. */
+	unsigned long prof_slow; /**< Log callback over nano-seconds. */
+	unsigned long spin_max; /**< Busy poll in nano-seconds, 0 disabled. */
+	struct timespec spin_last; /**< Last IO for interval. */
+	aloe_ev_spin_stat_t spin_stat;
 } aloe_ev_ctx_t;
 
+#ifdef WITH_IO_URING
+/** Setup ctx->uring. */
+int aloe_ev_uring_init(aloe_ev_ctx_t *ctx);
+
+/** Release ctx->uring. */
+void aloe_ev_uring_destroy(aloe_ev_ctx_t *ctx);
+
+/** Queue the IO, submit in batch by aloe_ev_uring_flush(). */
+int aloe_ev_uring_submit(aloe_ev_ctx_t *ctx, aloe_ev_ctx_io_t *io);
+
+/** Submit IO queued. */
+void aloe_ev_uring_flush(aloe_ev_ctx_t *ctx);
+#endif
+
+/** Slot for callback in profiling, the last for the rest. */
+#define ALOE_EV_PROF_SLOT 256
+
+/** Time before callback. */
+typedef struct aloe_ev_prof_ts_rec {
+	struct timespec wall, cpu;
+} aloe_ev_prof_ts_t;
+
+/** Setup ctx->prof. */
+int aloe_ev_prof_init(aloe_ev_ctx_t *ctx, unsigned long slow_us);
+
+/** Release ctx->prof. */
+void aloe_ev_prof_destroy(aloe_ev_ctx_t *ctx);
+
+/** Start timing the callback. */
+void aloe_ev_prof_enter(aloe_ev_ctx_t *ctx, aloe_ev_prof_ts_t *ts);
+
+/** Account the callback since aloe_ev_prof_enter(). */
+void aloe_ev_prof_leave(aloe_ev_ctx_t *ctx, aloe_ev_noti_cb_t cb,
+		const aloe_ev_prof_ts_t *ts);
+
+/** Complete the IO and release. */
+void aloe_ev_io_done(aloe_ev_ctx_t *ctx, aloe_ev_ctx_io_t *io, long res);
+
+/** Release IO without callback. */
+void aloe_ev_io_destroy(aloe_ev_ctx_t *ctx);
+
+/** Backend notify FD triggered. */
+void aloe_ev_fd_ready(aloe_ev_ctx_t *ctx, aloe_ev_ctx_fd_t *ev_fd,
+		unsigned triggered);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif